@@ -0,0 +1,137 @@
+/*
+ * FirmnginKit Static Benchmark
+ *
+ * Compares FirmnginKit with FirmnginKitStatic on the same board: RAM of
+ * the kit object, heap taken by begin(), and CPU cycles and heap per
+ * pushState() while connected. Build it twice, with USE_STATIC 0 and 1:
+ * the flash size is the "Sketch uses ... bytes" line of each build, the
+ * rest is printed on Serial.
+ *
+ * website: https://firmngin.dev
+ * author: Firmngin.dev
+ */
+
+#define USE_STATIC 1
+
+#include "keys.h"
+#if USE_STATIC
+#include "firmnginKitStatic.h"
+#else
+#include "firmnginKit.h"
+#endif
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#define DEVICE_ID "FNG_YOUR_DEVICE_ID"
+#define DEVICE_KEY "FNG_YOUR_DEVICE_KEY"
+
+// WiFi credentials
+const char *ssid = "YOUR_SSID";
+const char *password = "YOUR_PASSWORD";
+
+const int messages = 200;
+
+#if USE_STATIC
+// Same features as the runtime kit, so only the implementation differs
+struct BenchConfig : FirmnginStaticConfig {
+  FNGIN_DEVICE_TOPICS(DEVICE_ID);
+};
+
+#if defined(ESP8266)
+FirmnginKitStatic<BenchConfig> fngin(CLIENT_CERT, PRIVATE_KEY, SERVER_FINGERPRINT_BYTES);
+#elif defined(ESP32)
+FirmnginKitStatic<BenchConfig> fngin(SERVER_FINGERPRINT_BYTES, CLIENT_CERT, PRIVATE_KEY);
+#endif
+const char* variant = "FirmnginKitStatic";
+
+bool kitConnected()
+{
+  return fngin.connected();
+}
+#else
+#if defined(ESP8266)
+FirmnginKit fngin(DEVICE_ID, DEVICE_KEY, CLIENT_CERT, PRIVATE_KEY, SERVER_FINGERPRINT_BYTES);
+#elif defined(ESP32)
+FirmnginKit fngin(DEVICE_ID, DEVICE_KEY, SERVER_FINGERPRINT_BYTES, CLIENT_CERT, PRIVATE_KEY);
+#endif
+const char* variant = "FirmnginKit";
+
+// Set on the first connect
+bool kitConnected()
+{
+  return fngin.getTlsReadyMillis() > 0;
+}
+#endif
+
+bool measured = false;
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  WiFi.begin(ssid, password);
+  Serial.print("Connecting to WiFi");
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println();
+
+  uint32_t heapBefore = ESP.getFreeHeap();
+  fngin.begin();
+  uint32_t heapAfter = ESP.getFreeHeap();
+
+  Serial.println(variant);
+  Serial.print("  kit object   ");
+  Serial.print(sizeof(fngin));
+  Serial.println(" bytes");
+  Serial.print("  begin() heap ");
+  Serial.print((long)heapBefore - (long)heapAfter);
+  Serial.println(" bytes");
+}
+
+void loop()
+{
+  fngin.loop();
+  if (measured || !kitConnected()) return;
+  measured = true;
+
+  // Same call on both kits: integer key and value
+  uint32_t heapBefore = ESP.getFreeHeap();
+  uint32_t heapLowest = heapBefore;
+  uint32_t cycles = 0;
+  int failed = 0;
+  for (int i = 0; i < messages; i++) {
+    uint32_t start = ESP.getCycleCount();
+#if USE_STATIC
+    if (!fngin.pushState(20, i)) failed++;
+#else
+    fngin.pushState(20, i);   // failures are logged, not returned
+#endif
+    cycles += ESP.getCycleCount() - start;
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap < heapLowest) heapLowest = heap;
+    fngin.loop();
+  }
+
+  Serial.print("  pushState    ");
+  Serial.print(cycles / messages);
+  Serial.print(" cycles/message, up to ");
+  Serial.print((long)heapBefore - (long)heapLowest);
+  Serial.print(" bytes heap held, ");
+  Serial.print(failed);
+  Serial.println(" failed");
+  Serial.print("  loop() stack ");
+#if defined(ESP8266)
+  Serial.print(ESP.getFreeContStack());
+  Serial.println(" bytes free");
+#else
+  Serial.print(uxTaskGetStackHighWaterMark(nullptr));
+  Serial.println(" bytes free (high-water mark)");
+#endif
+}
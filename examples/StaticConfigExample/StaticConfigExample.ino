@@ -0,0 +1,77 @@
+/*
+ * FirmnginKit Static Config Example
+ *
+ * Example using FirmnginKitStatic: device ID, topics and features fixed at
+ * compile time. Unused features (here: monetize, batch) are compiled out.
+ * Compare the firmware size with PushStateExample to see the difference.
+ *
+ * website: https://firmngin.dev
+ * author: Firmngin.dev
+ */
+
+#include "keys.h"
+#include "firmnginKitStatic.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#define DEVICE_ID "FNG_YOUR_DEVICE_ID"
+
+// WiFi credentials
+const char *ssid = "YOUR_SSID";
+const char *password = "YOUR_PASSWORD";
+
+struct DeviceConfig : FirmnginStaticConfig {
+  FNGIN_DEVICE_TOPICS(DEVICE_ID);
+  static constexpr bool monetize = false;
+  static constexpr bool batch = false;
+  static constexpr uint8_t maxVirtualPins = 4;
+  static constexpr uint16_t bufferSize = 512;
+};
+
+#if defined(ESP8266)
+FirmnginKitStatic<DeviceConfig> fngin(CLIENT_CERT, PRIVATE_KEY, SERVER_FINGERPRINT_BYTES);
+#elif defined(ESP32)
+FirmnginKitStatic<DeviceConfig> fngin(SERVER_FINGERPRINT_BYTES, CLIENT_CERT, PRIVATE_KEY);
+#endif
+
+#define RELAY_PIN 2
+
+void onRelay(const char *payload, unsigned int length)
+{
+  bool on = length > 0 && (payload[0] == '1' || payload[0] == 'O' || payload[0] == 'o');
+  digitalWrite(RELAY_PIN, on ? HIGH : LOW);
+}
+
+unsigned long lastPush = 0;
+
+void setup()
+{
+  Serial.begin(115200);
+  pinMode(RELAY_PIN, OUTPUT);
+
+  // Connect to WiFi
+  WiFi.begin(ssid, password);
+  Serial.print("Connecting to WiFi");
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected!");
+
+  fngin.onVirtualPin(10, onRelay);
+  fngin.begin();
+}
+
+void loop()
+{
+  fngin.loop();
+
+  if (millis() - lastPush >= 5000) {
+    lastPush = millis();
+    fngin.pushState(20, analogRead(A0));   // integer value, no String involved
+  }
+}
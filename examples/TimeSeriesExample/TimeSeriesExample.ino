@@ -0,0 +1,75 @@
+/*
+ * FirmnginKit Time Series Example
+ *
+ * Example using TimeSeries to capture an analog signal at 1 kHz with
+ * microsecond timestamps, shipped as compact delta-encoded blocks
+ *
+ * website: https://firmngin.dev
+ * author: Firmngin.dev
+ */
+
+#include "keys.h"
+#include "firmnginKit.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#define DEVICE_ID "FNG_YOUR_DEVICE_ID"
+#define DEVICE_KEY "FNG_YOUR_DEVICE_KEY"
+
+// WiFi credentials
+const char *ssid = "YOUR_SSID";
+const char *password = "YOUR_PASSWORD";
+
+#if defined(ESP8266)
+FirmnginKit fngin(DEVICE_ID, DEVICE_KEY, CLIENT_CERT, PRIVATE_KEY, SERVER_FINGERPRINT_BYTES);
+#elif defined(ESP32)
+FirmnginKit fngin(DEVICE_ID, DEVICE_KEY, SERVER_FINGERPRINT_BYTES, CLIENT_CERT, PRIVATE_KEY);
+#endif
+
+// vpin 50, 1 KB blocks (two are allocated)
+TimeSeries current(50, 1024);
+
+const unsigned long samplePeriodUs = 1000;   // 1 kHz
+unsigned long lastSample = 0;
+
+void setup()
+{
+  Serial.begin(115200);
+
+  // Connect to WiFi
+  WiFi.begin(ssid, password);
+  Serial.print("Connecting to WiFi");
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("\nWiFi connected!");
+
+  fngin.begin();   // syncs NTP time used for block timestamps
+}
+
+void loop()
+{
+  unsigned long now = micros();
+  if (now - lastSample >= samplePeriodUs) {
+    lastSample += samplePeriodUs;
+    current.record((int32_t)analogRead(A0), now);
+  }
+
+  // Publishing is done outside the sampling path
+  fngin.loop();
+  current.send();
+
+  if (current.dropped() > 0) {
+    static uint32_t reported = 0;
+    if (current.dropped() != reported) {
+      reported = current.dropped();
+      Serial.print("Dropped samples: ");
+      Serial.println(reported);
+    }
+  }
+}
@@ -0,0 +1,79 @@
+/*
+ * FirmnginKit VPin Benchmark
+ *
+ * Measures the per-sample cost of VPin (float), IntVPin (int32_t) and
+ * FixedVPin<2> in CPU cycles. Needs no WiFi or broker: the condition check
+ * runs on every sample, and formatting only for samples that get pushed,
+ * so both are timed on their own.
+ *
+ * website: https://firmngin.dev
+ * author: Firmngin.dev
+ */
+
+#include "firmnginKit.h"
+
+const int samples = 2000;
+
+VPin floatPin(1);
+IntVPin intPin(2);
+FixedVPin<2> fixedPin(3);
+
+// Slowly rising reading with noise, like an ADC
+int32_t reading(int i)
+{
+  return 2000 + i / 4 + (i * 7919) % 13;
+}
+
+void report(const char* name, uint32_t checkCycles, uint32_t formatCycles)
+{
+  Serial.print(name);
+  Serial.print("  check ");
+  Serial.print(checkCycles / samples);
+  Serial.print(" cycles/sample, format ");
+  Serial.print(formatCycles / samples);
+  Serial.println(" cycles/sample");
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  floatPin.threshold(5.0f);
+  intPin.threshold(500);
+  fixedPin.threshold(Fixed<2>(500));
+
+  uint32_t start, check, format;
+  volatile size_t sink = 0;
+
+  // float: the value is in degrees, as a sketch would compute it
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) floatPin.push(reading(i) / 100.0f);
+  check = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) sink += VPinTraits<float>::format(reading(i) / 100.0f).length();
+  format = ESP.getCycleCount() - start;
+  report("VPin         ", check, format);
+
+  // int32_t: the raw reading
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) intPin.push(reading(i));
+  check = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) sink += VPinTraits<int32_t>::format(reading(i)).length();
+  format = ESP.getCycleCount() - start;
+  report("IntVPin      ", check, format);
+
+  // Fixed<2>: the reading as hundredths of a degree, sent as "20.05"
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) fixedPin.push(Fixed<2>(reading(i)));
+  check = ESP.getCycleCount() - start;
+  start = ESP.getCycleCount();
+  for (int i = 0; i < samples; i++) sink += VPinTraits<Fixed<2> >::format(Fixed<2>(reading(i))).length();
+  format = ESP.getCycleCount() - start;
+  report("FixedVPin<2> ", check, format);
+}
+
+void loop()
+{
+}
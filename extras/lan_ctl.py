@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Send VPin commands to a device over the LAN control channel and measure
+the round trip
+Usage:
+  python3 lan_ctl.py 192.168.1.50 DEVICE_ID DEVICE_KEY 5=ON
+  python3 lan_ctl.py 192.168.1.50 DEVICE_ID DEVICE_KEY "5=ON;7=128" --count 200 --interval 0.05
+
+The device must call fngin.enableLocalControl(). The client first asks for
+the device's boot nonce with "hello|hmac" (hmac over deviceId "|hello"), the
+device answers "hello|nonce|hmac". Commands are "seq|commands|hmac" with
+hmac = HMAC-SHA256(deviceKey, deviceId "|" nonce "|" seq "|" commands),
+replies are "seq|ok|handlerUs|hmac" signed the same way. Bad, stale and
+replayed datagrams get no reply.
+"""
+
+import argparse
+import hashlib
+import hmac
+import socket
+import sys
+import time
+
+DEFAULT_PORT = 4210
+
+
+def sign(key, device_id, nonce, message):
+    """nonce is None for the hello exchange"""
+    signed = f"{device_id}|{message}" if nonce is None else f"{device_id}|{nonce}|{message}"
+    return hmac.new(key.encode(), signed.encode(), hashlib.sha256).hexdigest()
+
+
+def build_request(key, device_id, nonce, seq, commands):
+    message = f"{seq}|{commands}"
+    return f"{message}|{sign(key, device_id, nonce, message)}".encode()
+
+
+def verified_message(key, device_id, nonce, data):
+    """Text before the signature, None if the datagram is not signed by the device"""
+    try:
+        text = data.decode()
+    except UnicodeDecodeError:
+        return None
+    message, _, signature = text.rpartition("|")
+    if not hmac.compare_digest(signature, sign(key, device_id, nonce, message)):
+        return None
+    return message
+
+
+def hello(sock, key, device_id, address):
+    """The device's boot nonce, None without a reply"""
+    sock.sendto(f"hello|{sign(key, device_id, None, 'hello')}".encode(), address)
+    while True:
+        try:
+            data, _ = sock.recvfrom(512)
+        except socket.timeout:
+            return None
+        message = verified_message(key, device_id, None, data)
+        if message and message.startswith("hello|"):
+            return message[6:]
+
+
+def parse_reply(key, device_id, nonce, data):
+    """(seq, status, handler_us), None if the reply is malformed or not signed by the device"""
+    message = verified_message(key, device_id, nonce, data)
+    if message is None:
+        return None
+    parts = message.split("|")
+    if len(parts) != 3:
+        return None
+    return int(parts[0]), parts[1], int(parts[2])
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="LAN control client for firmnginKit devices")
+    parser.add_argument("host", help="device IP address")
+    parser.add_argument("device_id")
+    parser.add_argument("device_key")
+    parser.add_argument("commands", help='"vpin=value" pairs, e.g. "5=ON;7=128"')
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--count", type=int, default=1, help="commands to send (default: 1)")
+    parser.add_argument("--interval", type=float, default=0.2, help="seconds between commands")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds to wait for a reply")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(args.timeout)
+
+    address = (args.host, args.port)
+    nonce = None
+    seq = 0
+    rtts = []
+    handler = []
+    lost = 0
+    for _ in range(args.count):
+        if nonce is None:
+            nonce = hello(sock, args.device_key, args.device_id, address)
+            if nonce is None:
+                lost += 1
+                print("  ✗ hello: no reply")
+                if args.interval > 0:
+                    time.sleep(args.interval)
+                continue
+
+        # Epoch ms, the device refuses numbers far from its own clock
+        seq = max(seq + 1, int(time.time() * 1000))
+        sent = time.perf_counter()
+        sock.sendto(build_request(args.device_key, args.device_id, nonce, seq, args.commands), address)
+
+        reply = None
+        while reply is None:
+            try:
+                data, _ = sock.recvfrom(512)
+            except socket.timeout:
+                break
+            reply = parse_reply(args.device_key, args.device_id, nonce, data)
+            if reply and reply[0] != seq:
+                reply = None    # late reply to an earlier command
+
+        if reply is None:
+            # Refused requests are not answered, the device may have rebooted
+            lost += 1
+            nonce = None
+            print(f"  ✗ {seq}: no reply")
+        else:
+            rtt = (time.perf_counter() - sent) * 1000
+            _, status, handler_us = reply
+            rtts.append(rtt)
+            handler.append(handler_us / 1000)
+            if args.count == 1:
+                print(f"  ✓ {status} in {rtt:.1f} ms (device {handler_us} us)")
+
+        if args.interval > 0:
+            time.sleep(args.interval)
+
+    if args.count > 1:
+        print(f"{args.count} sent, {len(rtts)} ok, {lost} lost")
+        if rtts:
+            print(f"round trip  p50 {percentile(rtts, 50):.1f}  p90 {percentile(rtts, 90):.1f}  "
+                  f"p99 {percentile(rtts, 99):.1f}  max {max(rtts):.1f} ms")
+            print(f"on device   p50 {percentile(handler, 50):.2f}  max {max(handler):.2f} ms")
+    sys.exit(0 if rtts else 1)
+
+
+if __name__ == "__main__":
+    main()
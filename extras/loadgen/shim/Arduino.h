@@ -0,0 +1,101 @@
+// Minimal Arduino core for Linux, enough to build firmnginKit, PubSubClient
+// and ArduinoJson for the load generator. Build with -DESP32 so the library
+// takes the ESP32 code path; TLS is replaced by plain TCP (see WiFiClient.h).
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <time.h>
+#include <sys/time.h>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "Client.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// The ESP32 core uses the std templates rather than macros
+using std::min;
+using std::max;
+using std::abs;
+using std::isnan;
+using std::isinf;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+uint32_t esp_random();
+
+// GPIO is not simulated, writes are dropped and reads return 0
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline void analogWrite(uint8_t, int) {}
+inline int analogRead(uint8_t) { return 0; }
+
+// The host clock is already set, NTP is not used
+inline void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr) {}
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer);
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    // Off by default: thousands of devices printing their banner is just noise
+    void setOutput(bool enabled) { _enabled = enabled; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+private:
+    bool _enabled = false;
+};
+
+extern HardwareSerial Serial;
+
+// restart() cannot reboot one simulated device, it is counted per thread
+// (see restartCount()) and the device keeps running its reconnect loop
+class EspClass {
+public:
+    void restart();
+    uint32_t getFreeHeap() { return 0; }
+    uint32_t restartCount();
+};
+
+extern EspClass ESP;
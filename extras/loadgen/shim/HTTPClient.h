@@ -0,0 +1,2 @@
+#pragma once
+// Included by firmnginKit.h on ESP32, HTTP is not used by the library
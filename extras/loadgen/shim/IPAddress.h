@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+class IPAddress {
+public:
+    IPAddress() : _address{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address{a, b, c, d} {}
+
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t& operator[](int index) { return _address[index]; }
+    bool operator==(const IPAddress& other) const {
+        return _address[0] == other._address[0] && _address[1] == other._address[1] &&
+               _address[2] == other._address[2] && _address[3] == other._address[3];
+    }
+
+    bool fromString(const char* address) {
+        unsigned a, b, c, d;
+        char tail;
+        if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+            return false;
+        }
+        _address[0] = a; _address[1] = b; _address[2] = c; _address[3] = d;
+        return true;
+    }
+
+private:
+    uint8_t _address[4];
+};
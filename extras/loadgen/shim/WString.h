@@ -0,0 +1,157 @@
+// Arduino String on top of std::string, for building the library on Linux
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <strings.h>
+
+class __FlashStringHelper;
+
+class String {
+public:
+    String() {}
+    String(const char* cstr) { if (cstr) _s = cstr; }
+    String(const char* cstr, unsigned int length) { if (cstr) _s.assign(cstr, length); }
+    String(const __FlashStringHelper* str) : String(reinterpret_cast<const char*>(str)) {}
+    String(const std::string& str) : _s(str) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(int value, unsigned char base = 10) : _s(formatSigned(value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(long value, unsigned char base = 10) : _s(formatSigned(value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(long long value, unsigned char base = 10) : _s(formatSigned(value, base)) {}
+    explicit String(unsigned long long value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(float value, unsigned char decimals = 2) : _s(formatFloat(value, decimals)) {}
+    explicit String(double value, unsigned char decimals = 2) : _s(formatFloat(value, decimals)) {}
+
+    String& operator=(const char* cstr) { if (cstr) _s = cstr; else _s.clear(); return *this; }
+
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return (unsigned int)_s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    bool reserve(unsigned int size) { _s.reserve(size); return true; }
+    explicit operator bool() const { return true; }
+
+    bool concat(const String& str) { _s += str._s; return true; }
+    bool concat(const char* cstr) { if (cstr) _s += cstr; return true; }
+    bool concat(const char* cstr, unsigned int length) { if (cstr) _s.append(cstr, length); return true; }
+    bool concat(char c) { _s += c; return true; }
+    template <typename T> bool concat(T value) { _s += String(value)._s; return true; }
+
+    String& operator+=(const String& str) { concat(str); return *this; }
+    String& operator+=(const char* cstr) { concat(cstr); return *this; }
+    String& operator+=(char c) { concat(c); return *this; }
+    template <typename T> String& operator+=(T value) { concat(value); return *this; }
+
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs._s + rhs._s); }
+    friend String operator+(const String& lhs, const char* rhs) { String r(lhs); r.concat(rhs); return r; }
+    friend String operator+(const char* lhs, const String& rhs) { String r(lhs); r.concat(rhs); return r; }
+    friend String operator+(const String& lhs, char rhs) { String r(lhs); r.concat(rhs); return r; }
+    template <typename T> friend String operator+(const String& lhs, T rhs) { String r(lhs); r.concat(rhs); return r; }
+
+    bool equals(const String& str) const { return _s == str._s; }
+    bool equals(const char* cstr) const { return _s == (cstr ? cstr : ""); }
+    bool equalsIgnoreCase(const String& str) const { return _s.size() == str._s.size() && strcasecmp(c_str(), str.c_str()) == 0; }
+    int compareTo(const String& str) const { return _s.compare(str._s); }
+    bool operator==(const String& str) const { return equals(str); }
+    bool operator==(const char* cstr) const { return equals(cstr); }
+    bool operator!=(const String& str) const { return !equals(str); }
+    bool operator!=(const char* cstr) const { return !equals(cstr); }
+    bool operator<(const String& str) const { return _s < str._s; }
+    bool operator>(const String& str) const { return _s > str._s; }
+
+    bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+    bool startsWith(const String& prefix, unsigned int offset) const {
+        return offset <= _s.size() && _s.compare(offset, prefix._s.size(), prefix._s) == 0;
+    }
+    bool endsWith(const String& suffix) const {
+        return _s.size() >= suffix._s.size() && _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+    }
+
+    char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if (index < _s.size()) _s[index] = c; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return _s[index]; }
+
+    int indexOf(char c, unsigned int from = 0) const { return found(_s.find(c, from)); }
+    int indexOf(const String& str, unsigned int from = 0) const { return found(_s.find(str._s, from)); }
+    int lastIndexOf(char c) const { return found(_s.rfind(c)); }
+    int lastIndexOf(char c, unsigned int from) const { return found(_s.rfind(c, from)); }
+    int lastIndexOf(const String& str) const { return found(_s.rfind(str._s)); }
+    int lastIndexOf(const String& str, unsigned int from) const { return found(_s.rfind(str._s, from)); }
+
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= _s.size()) return String();
+        return String(_s.substr(from, to - from));
+    }
+
+    void replace(char find, char with) { for (char& c : _s) if (c == find) c = with; }
+    void replace(const String& find, const String& with) {
+        if (find._s.empty()) return;
+        for (size_t pos = 0; (pos = _s.find(find._s, pos)) != std::string::npos; pos += with._s.size()) {
+            _s.replace(pos, find._s.size(), with._s);
+        }
+    }
+    void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+    void toLowerCase() { for (char& c : _s) c = tolower((unsigned char)c); }
+    void toUpperCase() { for (char& c : _s) c = toupper((unsigned char)c); }
+    void trim() {
+        size_t begin = _s.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) { _s.clear(); return; }
+        _s = _s.substr(begin, _s.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    long toInt() const { return strtol(c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(c_str(), nullptr); }
+    double toDouble() const { return strtod(c_str(), nullptr); }
+
+    void getBytes(unsigned char* buf, unsigned int size, unsigned int index = 0) const {
+        if (!size) return;
+        size_t n = index < _s.size() ? std::min<size_t>(size - 1, _s.size() - index) : 0;
+        memcpy(buf, _s.data() + index, n);
+        buf[n] = 0;
+    }
+    void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const {
+        getBytes((unsigned char*)buf, size, index);
+    }
+
+private:
+    std::string _s;
+
+    static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+    static std::string format(unsigned long long value, unsigned char base) {
+        if (base < 2 || base > 36) base = 10;
+        char buf[65];
+        char* p = buf + sizeof(buf) - 1;
+        *p = 0;
+        do {
+            unsigned digit = value % base;
+            *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+            value /= base;
+        } while (value);
+        return p;
+    }
+    static std::string formatSigned(long long value, unsigned char base) {
+        if (value < 0 && base == 10) return "-" + format(0ULL - (unsigned long long)value, base);
+        return format((unsigned long long)value, base);
+    }
+    static std::string formatFloat(double value, unsigned char decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        return buf;
+    }
+};
+
+// Distinct type as in the Arduino core, ArduinoJson adapts both
+class StringSumHelper : public String {
+public:
+    StringSumHelper(const String& str) : String(str) {}
+};
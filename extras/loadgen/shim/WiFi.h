@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+// The host network is always up
+class WiFiClass {
+public:
+    wl_status_t status() { return WL_CONNECTED; }
+    bool isConnected() { return true; }
+    // No radio to power down
+    bool setSleep(bool) { return true; }
+    bool setSleep(wifi_ps_type_t) { return true; }
+    int hostByName(const char* host, IPAddress& result);
+};
+
+extern WiFiClass WiFi;
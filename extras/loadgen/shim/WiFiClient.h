@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Non-blocking TCP client over POSIX sockets. Reads never block, so
+// PubSubClient::loop() returns when there is nothing to do.
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+    ~WiFiClient() override { stop(); }
+    WiFiClient(const WiFiClient&) = delete;
+    WiFiClient& operator=(const WiFiClient&) = delete;
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    int connect(const char* host, uint16_t port, int32_t timeoutMs) {
+        _connectTimeoutMs = timeoutMs;
+        return connect(host, port);
+    }
+    int connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+        _connectTimeoutMs = timeoutMs;
+        return connect(ip, port);
+    }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    // Close with RST instead of FIN, the broker sees an unclean disconnect
+    void abort();
+    // Wait up to timeoutMs for incoming data
+    bool waitReadable(int timeoutMs);
+    void setConnectTimeout(int timeoutMs) { _connectTimeoutMs = timeoutMs; }
+    int fd() const { return _fd; }
+
+private:
+    int _fd = -1;
+    uint8_t _rx[1024];
+    size_t _rxHead = 0;
+    size_t _rxLength = 0;
+    bool _peerClosed = false;
+    int _connectTimeoutMs = 5000;
+
+    bool fill();
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "WiFiClient.h"
+
+// Credentials are accepted and ignored, the connection is plain TCP
+// (point the load generator at a broker listener without TLS)
+class WiFiClientSecure : public WiFiClient {
+public:
+    void setCACert(const char*) {}
+    void setCertificate(const char*) {}
+    void setPrivateKey(const char*) {}
+    void setInsecure() {}
+    void setTimeout(unsigned long) {}
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Non-blocking UDP socket with the ESP WiFiUDP packet API
+class WiFiUDP {
+public:
+    WiFiUDP() {}
+    ~WiFiUDP() { stop(); }
+    WiFiUDP(const WiFiUDP&) = delete;
+    WiFiUDP& operator=(const WiFiUDP&) = delete;
+
+    uint8_t begin(uint16_t port);
+    void stop();
+
+    // Size of the next datagram, 0 if none
+    int parsePacket();
+    int available() { return (int)(_rxLength - _rxHead); }
+    int read(uint8_t* buffer, size_t size);
+    IPAddress remoteIP() { return _remoteIP; }
+    uint16_t remotePort() { return _remotePort; }
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const uint8_t* buffer, size_t size);
+    int endPacket();
+
+private:
+    int _fd = -1;
+    uint8_t _rx[1472];
+    size_t _rxHead = 0;
+    size_t _rxLength = 0;
+    IPAddress _remoteIP;
+    uint16_t _remotePort = 0;
+    uint8_t _tx[1472];
+    size_t _txLength = 0;
+    IPAddress _txIP;
+    uint16_t _txPort = 0;
+};
@@ -0,0 +1,346 @@
+// Linux implementations of the shim: clock, Serial, ESP, TCP and UDP
+#include "Arduino.h"
+#include "WiFi.h"
+#include "WiFiUdp.h"
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// PubSubClient busy-waits on available() with yield() in between, sleep
+// briefly so thousands of waiting devices do not each spin a core
+void yield() {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static std::mt19937& randomEngine() {
+    static thread_local std::mt19937 engine(std::random_device{}());
+    return engine;
+}
+
+long random(long howBig) {
+    return howBig > 0 ? random(0, howBig) : 0;
+}
+
+long random(long howSmall, long howBig) {
+    if (howSmall >= howBig) return howSmall;
+    return std::uniform_int_distribution<long>(howSmall, howBig - 1)(randomEngine());
+}
+
+void randomSeed(unsigned long seed) {
+    randomEngine().seed(seed);
+}
+
+uint32_t esp_random() {
+    static std::random_device device;
+    return device();
+}
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer) {
+    sprintf(buffer, "%*.*f", width, precision, value);
+    return buffer;
+}
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length) {
+    size_t count = 0;
+    unsigned long start = millis();
+    while (count < length) {
+        int c = read();
+        if (c < 0) {
+            if (millis() - start >= _timeout) break;
+            yield();
+            continue;
+        }
+        buffer[count++] = (uint8_t)c;
+    }
+    return count;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (!_enabled) return size;
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    return fwrite(buffer, 1, size, stdout);
+}
+
+static thread_local uint32_t restarts = 0;
+
+void EspClass::restart() {
+    restarts++;
+}
+
+uint32_t EspClass::restartCount() {
+    return restarts;
+}
+
+int WiFiClass::hostByName(const char* host, IPAddress& result) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    struct addrinfo* found = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &found) != 0 || !found) {
+        return 0;
+    }
+    uint32_t address = ntohl(((struct sockaddr_in*)found->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(found);
+    result = IPAddress(address >> 24, address >> 16, address >> 8, address);
+    return 1;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    char host[16];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    stop();
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0 || !result) {
+        return 0;
+    }
+
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        freeaddrinfo(result);
+        return 0;
+    }
+
+    int rc = ::connect(fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (rc < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (poll(&pfd, 1, _connectTimeoutMs) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0) {
+            rc = 0;
+        }
+    }
+    if (rc < 0) {
+        close(fd);
+        return 0;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    _fd = fd;
+    _rxHead = 0;
+    _rxLength = 0;
+    _peerClosed = false;
+    return 1;
+}
+
+// Writes wait for socket space, a broker that stops reading for 5 s drops the connection
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+    if (_fd < 0) return 0;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = send(_fd, buffer + written, size - written, MSG_NOSIGNAL);
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { _fd, POLLOUT, 0 };
+            if (poll(&pfd, 1, 5000) == 1) continue;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        stop();
+        break;
+    }
+    return written;
+}
+
+bool WiFiClient::fill() {
+    if (_fd < 0 || _peerClosed) return false;
+    if (_rxHead == _rxLength) {
+        _rxHead = 0;
+        _rxLength = 0;
+    }
+    if (_rxLength == sizeof(_rx)) return true;
+    ssize_t n = recv(_fd, _rx + _rxLength, sizeof(_rx) - _rxLength, MSG_DONTWAIT);
+    if (n > 0) {
+        _rxLength += n;
+        return true;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        _peerClosed = true;
+    }
+    return false;
+}
+
+int WiFiClient::available() {
+    if (_rxHead == _rxLength) fill();
+    return (int)(_rxLength - _rxHead);
+}
+
+int WiFiClient::read() {
+    if (!available()) return -1;
+    return _rx[_rxHead++];
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+    int count = available();
+    if (count <= 0) return -1;
+    size_t n = std::min(size, (size_t)count);
+    memcpy(buffer, _rx + _rxHead, n);
+    _rxHead += n;
+    return (int)n;
+}
+
+int WiFiClient::peek() {
+    if (!available()) return -1;
+    return _rx[_rxHead];
+}
+
+void WiFiClient::stop() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _rxHead = 0;
+    _rxLength = 0;
+    _peerClosed = false;
+}
+
+void WiFiClient::abort() {
+    if (_fd >= 0) {
+        struct linger reset = { 1, 0 };
+        setsockopt(_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+    stop();
+}
+
+// Buffered data can still be read after the peer closed, like on the ESP
+uint8_t WiFiClient::connected() {
+    if (_fd < 0) return 0;
+    if (_rxHead < _rxLength) return 1;
+    fill();
+    if (_rxHead < _rxLength) return 1;
+    return _peerClosed ? 0 : 1;
+}
+
+bool WiFiClient::waitReadable(int timeoutMs) {
+    if (_rxHead < _rxLength) return true;
+    if (_fd < 0) {
+        delay(timeoutMs);
+        return false;
+    }
+    struct pollfd pfd = { _fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) > 0;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    stop();
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 0;
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return 0;
+    }
+    _fd = fd;
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _rxHead = 0;
+    _rxLength = 0;
+}
+
+// Like on the ESP, the rest of an unread datagram is dropped
+int WiFiUDP::parsePacket() {
+    _rxHead = 0;
+    _rxLength = 0;
+    if (_fd < 0) return 0;
+    struct sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    ssize_t n = recvfrom(_fd, _rx, sizeof(_rx), MSG_DONTWAIT, (struct sockaddr*)&from, &fromLength);
+    if (n <= 0) return 0;
+    uint32_t address = ntohl(from.sin_addr.s_addr);
+    _remoteIP = IPAddress(address >> 24, address >> 16, address >> 8, address);
+    _remotePort = ntohs(from.sin_port);
+    _rxLength = n;
+    return (int)n;
+}
+
+int WiFiUDP::read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, _rxLength - _rxHead);
+    memcpy(buffer, _rx + _rxHead, n);
+    _rxHead += n;
+    return (int)n;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _txIP = ip;
+    _txPort = port;
+    _txLength = 0;
+    return _fd >= 0;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, sizeof(_tx) - _txLength);
+    memcpy(_tx + _txLength, buffer, n);
+    _txLength += n;
+    return n;
+}
+
+int WiFiUDP::endPacket() {
+    if (_fd < 0) return 0;
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl((uint32_t)_txIP[0] << 24 | (uint32_t)_txIP[1] << 16 | (uint32_t)_txIP[2] << 8 | _txIP[3]);
+    to.sin_port = htons(_txPort);
+    ssize_t n = sendto(_fd, _tx, _txLength, 0, (struct sockaddr*)&to, sizeof(to));
+    _txLength = 0;
+    return n >= 0;
+}
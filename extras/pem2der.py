@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""
+Convert the PEM credentials in keys.h to pre-decoded DER arrays
+Usage:
+  python3 pem2der.py keys.h > keys_der.h
+  python3 pem2der.py keys.h -o keys_der.h
+
+Every `static const char NAME[] PROGMEM = R"EOF(...)EOF";` block holding a
+PEM becomes `static const uint8_t NAME_DER[] PROGMEM = {...};`, to be used
+with setClientCertDer(), setPrivateKeyDer() and setCACertDer(). The PEM label
+(key type) is kept as a comment above each array; encrypted keys are skipped
+because the library cannot decrypt them.
+"""
+
+import argparse
+import base64
+import re
+import sys
+from pathlib import Path
+
+PEM_VAR = re.compile(
+    r'static\s+const\s+char\s+(\w+)\[\]\s+PROGMEM\s*=\s*R"EOF\((.*?)\)EOF";',
+    re.DOTALL,
+)
+PEM_BLOCK = re.compile(r"-----BEGIN ([A-Z ]+)-----(.*?)-----END \1-----", re.DOTALL)
+
+
+def pem_to_der(pem):
+    """Decode the first PEM block into (label, der), None if there is no valid block"""
+    match = PEM_BLOCK.search(pem)
+    if not match:
+        return None
+    body = "".join(match.group(2).split())
+    try:
+        return match.group(1), base64.b64decode(body, validate=True)
+    except ValueError:
+        return None
+
+
+def c_array(name, label, der):
+    lines = [f"// {label}", f"static const uint8_t {name}_DER[] PROGMEM = {{"]
+    for i in range(0, len(der), 16):
+        chunk = ", ".join(f"0x{b:02x}" for b in der[i:i + 16])
+        lines.append(f"  {chunk},")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def convert(source):
+    arrays = []
+    for name, pem in PEM_VAR.findall(source):
+        decoded = pem_to_der(pem)
+        if decoded is None:
+            print(f"  ⊙ {name}: no valid PEM block, skipped", file=sys.stderr)
+            continue
+        label, der = decoded
+        if label == "ENCRYPTED PRIVATE KEY" or "Proc-Type: 4,ENCRYPTED" in pem:
+            print(f"  ⊙ {name}: encrypted key, skipped (decrypt it first)", file=sys.stderr)
+            continue
+        arrays.append(c_array(name, label, der))
+        print(f"  ✓ {name} → {name}_DER ({label}, {len(der)} bytes)", file=sys.stderr)
+    return arrays
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert keys.h PEM credentials to DER arrays")
+    parser.add_argument("keys", help="keys.h with PEM credentials")
+    parser.add_argument("-o", "--output", help="output header (default: stdout)")
+    args = parser.parse_args()
+
+    arrays = convert(Path(args.keys).read_text())
+    if not arrays:
+        print("✗ No PEM credentials found", file=sys.stderr)
+        sys.exit(1)
+
+    header = "\n".join([
+        "// Generated by extras/pem2der.py - DO NOT commit, contains your private key",
+        "#ifndef KEYS_DER_H",
+        "#define KEYS_DER_H",
+        "",
+        "\n\n".join(arrays),
+        "",
+        "#endif // KEYS_DER_H",
+        "",
+    ])
+
+    if args.output:
+        Path(args.output).write_text(header)
+    else:
+        sys.stdout.write(header)
+
+
+if __name__ == "__main__":
+    main()
@@ -61,6 +61,7 @@ cp "$LIB_DIR/CHANGELOG.md" "$RELEASE_DIR/" 2>/dev/null || echo "CHANGELOG.md tid
 # Copy source files - memperbaiki format perintah cp
 cp "$ROOT_DIR/src/firmnginKit.h" "$RELEASE_DIR/src/" 2>/dev/null || echo "firmnginKit.h tidak ditemukan"
 cp "$ROOT_DIR/src/firmnginKit.cpp" "$RELEASE_DIR/src/" 2>/dev/null || echo "firmnginKit.cpp tidak ditemukan"
+cp "$ROOT_DIR/src/firmnginKitStatic.h" "$RELEASE_DIR/src/" 2>/dev/null || echo "firmnginKitStatic.h tidak ditemukan"
 
 # Copy examples
 echo "Menyalin examples..."
@@ -0,0 +1,21 @@
+// Minimal checks for the host tests: CHECK reports a failure and carries
+// on, testResult() prints the summary and gives the exit status
+#pragma once
+
+#include <cstdio>
+
+static int testFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            testFailures++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+static int testResult(const char* name) {
+    if (testFailures) printf("%s: %d failed\n", name, testFailures);
+    else printf("%s: ok\n", name);
+    return testFailures ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+// LAN control signatures: HMAC-SHA256 against the RFC 4231 test vectors
+#include "firmnginKit.h"
+#include "test.h"
+
+#include <string>
+
+static std::string hex(const uint8_t* bytes, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text;
+    for (size_t i = 0; i < length; i++) {
+        text += digits[bytes[i] >> 4];
+        text += digits[bytes[i] & 0x0F];
+    }
+    return text;
+}
+
+static std::string sign(const std::string& key, const std::string& message) {
+    const char* parts[] = { message.c_str() };
+    size_t lengths[] = { message.size() };
+    uint8_t mac[32];
+    hmacSha256((const uint8_t*)key.data(), key.size(), parts, lengths, 1, mac);
+    return hex(mac, sizeof(mac));
+}
+
+static void testVectors() {
+    // Test case 1
+    CHECK(sign(std::string(20, '\x0b'), "Hi There") ==
+          "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+    // Test case 2, key shorter than the block
+    CHECK(sign("Jefe", "what do ya want for nothing?") ==
+          "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    // Test case 6, key longer than the block is hashed first
+    CHECK(sign(std::string(131, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First") ==
+          "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+}
+
+// The parts are signed as if concatenated
+static void testParts() {
+    const char* parts[] = { "device-1", "|", "1a2b3c4d", "|", "1700000000000|5=ON" };
+    size_t lengths[] = { 8, 1, 8, 1, 18 };
+    uint8_t mac[32];
+    hmacSha256((const uint8_t*)"key", 3, parts, lengths, 5, mac);
+    CHECK(hex(mac, sizeof(mac)) == sign("key", "device-1|1a2b3c4d|1700000000000|5=ON"));
+
+    // A different nonce gives a different signature
+    parts[2] = "5e6f7a8b";
+    uint8_t other[32];
+    hmacSha256((const uint8_t*)"key", 3, parts, lengths, 5, other);
+    CHECK(memcmp(mac, other, sizeof(mac)) != 0);
+}
+
+int main() {
+    testVectors();
+    testParts();
+    return testResult("test_local");
+}
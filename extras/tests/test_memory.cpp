@@ -0,0 +1,89 @@
+// Memory budget split and the pooled arena
+#include "firmnginKit.h"
+#include "test.h"
+
+static void testBudgetSplit() {
+    FirmnginKit kit("dev", "key", (const char*)nullptr, nullptr, nullptr);
+
+    // The constructor applies MEMORY_BALANCED: the MQTT buffer of previous releases
+    MemoryStats stats = kit.getMemoryStats();
+    CHECK(stats.budget == MEMORY_BUDGET_BALANCED);
+    CHECK(stats.mqttBuffer == 2048);
+    CHECK(stats.tlsRxBuffer == 0 && stats.tlsTxBuffer == 0);
+    CHECK(stats.arenaSize == 4096);
+
+    kit.setMemoryProfile(MEMORY_LOW);
+    stats = kit.getMemoryStats();
+    CHECK(stats.mqttBuffer == 1024);
+    CHECK(stats.mqttBuffer + stats.arenaSize == MEMORY_BUDGET_LOW);
+    CHECK(stats.batchCapacity == stats.arenaSize * 2 / 3);
+
+    // Tiny budgets keep the minimum sizes
+    kit.setMemoryBudget(100);
+    stats = kit.getMemoryStats();
+    CHECK(stats.mqttBuffer == 256);
+    CHECK(stats.arenaSize == 256);
+}
+
+static void testArena() {
+    FirmnginArena arena;
+    CHECK(arena.reserve(256));
+
+    void* a = arena.allocate(40);
+    void* b = arena.allocate(40);
+    CHECK(a && b && a != b);
+    CHECK(arena.fallbacks() == 0);
+
+    // Does not fit: heap, counted
+    void* big = arena.allocate(1024);
+    CHECK(big != nullptr);
+    CHECK(arena.fallbacks() == 1);
+    arena.deallocate(big);
+
+    // The last block grows in place
+    memset(b, 0x5A, 40);
+    void* grown = arena.reallocate(b, 80);
+    CHECK(grown == b);
+    CHECK(((uint8_t*)grown)[39] == 0x5A);
+
+    // Rewound once every block is freed
+    size_t peak = arena.peak();
+    arena.deallocate(a);
+    arena.deallocate(grown);
+    CHECK(arena.allocate(16) == a);
+    CHECK(arena.peak() == peak);
+
+    CHECK(arena.scratch(1024) == nullptr);
+    CHECK(arena.scratch(64) != nullptr);
+}
+
+// A block kept alive (a BatchState) only pins the arena up to its own end
+static void testRewindToLive() {
+    FirmnginArena arena;
+    CHECK(arena.reserve(256));
+
+    void* kept = arena.allocate(40);
+    void* a = arena.allocate(40);
+    void* b = arena.allocate(40);
+    CHECK(kept && a && b);
+
+    // Freeing a middle block does not rewind
+    arena.deallocate(a);
+    void* c = arena.allocate(16);
+    CHECK(c != a && c > b);
+
+    // Freeing the last one rewinds to the end of the highest live block
+    arena.deallocate(c);
+    CHECK(arena.allocate(16) == c);
+    arena.deallocate(c);
+    arena.deallocate(b);
+    CHECK(arena.allocate(16) == a);
+    CHECK(arena.fallbacks() == 0);
+}
+
+int main() {
+    testBudgetSplit();
+    testArena();
+    testRewindToLive();
+    return testResult("test_memory");
+}
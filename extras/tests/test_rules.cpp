@@ -0,0 +1,72 @@
+// EdgeRules: compiling, edge-triggered firing and reloads
+#include "firmnginKit.h"
+#include "test.h"
+
+#include <vector>
+
+struct Action {
+    int vpin;
+    int32_t value;
+};
+
+static void testFiring() {
+    std::vector<Action> actions;
+    EdgeRules rules([&](int vpin, int32_t value) { actions.push_back({vpin, value}); });
+    const char* text = "10>30:5=1;10<28:5=0;11>=2.5:7=128|0";
+    CHECK(rules.compile(text, strlen(text)));
+    CHECK(rules.count() == 3);
+
+    // Fires once on the edge, not again while the condition holds
+    rules.evaluate(10, 31, 0);
+    rules.evaluate(10, 32, 0);
+    CHECK(actions.size() == 1);
+    CHECK(actions[0].vpin == 5 && actions[0].value == 1);
+
+    rules.evaluate(10, 27, 0);
+    CHECK(actions.size() == 2);
+    CHECK(actions[1].value == 0);
+
+    // Release value when the condition goes false
+    rules.evaluate(11, 3, 0);
+    rules.evaluate(11, 1, 0);
+    CHECK(actions.size() == 4);
+    CHECK(actions[2].vpin == 7 && actions[2].value == 128);
+    CHECK(actions[3].vpin == 7 && actions[3].value == 0);
+
+    RuleFiring firing;
+    int firings = 0;
+    while (rules.nextFiring(firing)) firings++;
+    CHECK(firings == 4);
+}
+
+static void testReload() {
+    int fired = 0;
+    EdgeRules rules([&](int, int32_t) { fired++; });
+    const char* text = "10>30:5=1";
+    CHECK(rules.compile(text, strlen(text)));
+    rules.evaluate(10, 31, 0);
+    CHECK(fired == 1);
+
+    // Same rule again: still active, no second firing
+    const char* reloaded = "12>1:6=1;10>30:5=1";
+    CHECK(rules.compile(reloaded, strlen(reloaded)));
+    rules.evaluate(10, 35, 0);
+    CHECK(fired == 1);
+
+    // A changed rule starts inactive
+    const char* changed = "10>30:5=ON|OFF";
+    CHECK(rules.compile(changed, strlen(changed)));
+    rules.evaluate(10, 35, 0);
+    CHECK(fired == 2);
+
+    // Syntax error keeps the old table
+    const char* broken = "10>>30:5=1";
+    CHECK(!rules.compile(broken, strlen(broken)));
+    CHECK(rules.count() == 1);
+}
+
+int main() {
+    testFiring();
+    testReload();
+    return testResult("test_rules");
+}
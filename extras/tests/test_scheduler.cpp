@@ -0,0 +1,88 @@
+// OutboundScheduler: token buckets, submit results and failing messages
+#include "firmnginKit.h"
+#include "test.h"
+
+static void testFractionalRate() {
+    // 0.5 msg/s: refilled in 10 ms steps, like a busy loop() would
+    TokenBucket slow;
+    slow.configure(500, 1000);
+    slow.take(1);
+    for (int i = 0; i < 200; i++) slow.refill(10);
+    CHECK(slow.allows(1));
+
+    // 2.5 msg/s over 4 s of 1 ms steps is 10 messages, not 8
+    TokenBucket bucket;
+    bucket.configure(2500, 100000);
+    bucket.take(100);
+    for (int i = 0; i < 4000; i++) bucket.refill(1);
+    CHECK(bucket.tokens() == 10000);
+
+    // Full bucket drops the remainder
+    bucket.configure(2500, 1000);
+    bucket.refill(1);
+    CHECK(bucket.tokens() == 1000);
+}
+
+static void testSubmitResults() {
+    bool accept = true;
+    int sent = 0;
+    OutboundScheduler scheduler(2, [&](const char*, const uint8_t*, size_t, bool) {
+        if (accept) sent++;
+        return accept;
+    });
+    const uint8_t payload[] = "x";
+
+    CHECK(scheduler.submit(LANE_STATE, "/t", payload, 1, false) == SUBMIT_SENT);
+
+    accept = false;
+    CHECK(scheduler.submit(LANE_STATE, "/t", payload, 1, false) == SUBMIT_QUEUED);
+    CHECK(scheduler.submit(LANE_STATE, "/t", payload, 1, false) == SUBMIT_QUEUED);
+    CHECK(scheduler.submit(LANE_STATE, "/t", payload, 1, false) == SUBMIT_DROPPED);
+    CHECK(scheduler.stats(LANE_STATE).dropped == 1);
+
+    accept = true;
+    scheduler.drain();
+    CHECK(scheduler.empty());
+    CHECK(sent == 3);
+    CHECK(scheduler.stats(LANE_STATE).sent == 3);
+}
+
+static void testFailingHead() {
+    OutboundScheduler scheduler(4, [&](const char* topic, const uint8_t*, size_t, bool) {
+        return strcmp(topic, "/bad") != 0;
+    });
+    const uint8_t payload[] = "x";
+
+    scheduler.hold(true);
+    scheduler.submit(LANE_STATE, "/bad", payload, 1, false);
+    scheduler.submit(LANE_STATE, "/good", payload, 1, false);
+    scheduler.hold(false);
+
+    // The head is refused until it runs out of attempts, then the lane moves on
+    for (uint8_t i = 1; i < OutboundScheduler::MAX_SEND_ATTEMPTS; i++) {
+        scheduler.drain();
+        CHECK(scheduler.stats(LANE_STATE).queued == 2);
+    }
+    scheduler.drain();
+    LaneStats stats = scheduler.stats(LANE_STATE);
+    CHECK(stats.queued == 0);
+    CHECK(stats.failed == 1);
+    CHECK(stats.sent == 1);
+}
+
+static void testLargeByteRate() {
+    OutboundScheduler scheduler(1, [](const char*, const uint8_t*, size_t, bool) { return true; });
+    // 4.3 MB/s does not fit in uint32_t thousandths: clamped, not wrapped to 5 KB/s
+    scheduler.setRate(LANE_BULK, 1000, 4300000);
+    static uint8_t payload[6000];
+    CHECK(scheduler.submit(LANE_BULK, "/t", payload, sizeof(payload), false) == SUBMIT_SENT);
+    CHECK(scheduler.submit(LANE_BULK, "/t", payload, sizeof(payload), false) == SUBMIT_SENT);
+}
+
+int main() {
+    testFractionalRate();
+    testSubmitResults();
+    testFailingHead();
+    testLargeByteRate();
+    return testResult("test_scheduler");
+}
@@ -0,0 +1,67 @@
+// SequenceWindow: storing, eviction and range lookups
+#include "firmnginKit.h"
+#include "test.h"
+
+#include <vector>
+
+// The window stores the topic as an opaque byte
+static const uint8_t TOPIC_STATE = 1;
+static const uint8_t TOPIC_BATCH = 2;
+
+static std::vector<uint32_t> collect(const SequenceWindow& window, uint32_t from, uint32_t to) {
+    std::vector<uint32_t> seqs;
+    window.forEach(from, to, [&](uint32_t seq, uint8_t, const uint8_t*, size_t) {
+        seqs.push_back(seq);
+    });
+    return seqs;
+}
+
+static void testStoreAndLookup() {
+    SequenceWindow window(256);
+    CHECK(window.oldest() == 0);
+
+    const uint8_t payload[] = {'a', 'b', 'c'};
+    CHECK(window.store(1, TOPIC_STATE, payload, sizeof(payload)));
+    CHECK(window.store(2, TOPIC_BATCH, payload, 2));
+    CHECK(window.oldest() == 1);
+
+    uint8_t topic = 0;
+    size_t length = 0;
+    bool matches = false;
+    window.forEach(2, 2, [&](uint32_t, uint8_t t, const uint8_t* data, size_t l) {
+        topic = t;
+        length = l;
+        matches = memcmp(data, payload, l) == 0;
+    });
+    CHECK(topic == TOPIC_BATCH);
+    CHECK(length == 2);
+    CHECK(matches);
+
+    CHECK(collect(window, 1, 5).size() == 2);
+    CHECK(collect(window, 3, 5).empty());
+}
+
+static void testEviction() {
+    // Room for four 20-byte payloads (7-byte header each)
+    SequenceWindow window(4 * 27);
+    uint8_t payload[20] = {0};
+    for (uint32_t seq = 1; seq <= 10; seq++) {
+        CHECK(window.store(seq, TOPIC_STATE, payload, sizeof(payload)));
+    }
+    CHECK(window.oldest() == 7);
+
+    std::vector<uint32_t> seqs = collect(window, 1, 10);
+    CHECK(seqs.size() == 4);
+    CHECK(seqs.front() == 7 && seqs.back() == 10);
+
+    // Larger than the whole window
+    uint8_t big[200] = {0};
+    CHECK(!window.store(11, TOPIC_STATE, big, sizeof(big)));
+    CHECK(window.oldest() == 7);
+}
+
+int main() {
+    testStoreAndLookup();
+    testEviction();
+    return testResult("test_sequence");
+}
@@ -0,0 +1,63 @@
+// StateShadow: dirty tracking per key and slot capacity
+#include "firmnginKit.h"
+#include "test.h"
+
+static void testDirty() {
+    StateShadow shadow(4);
+    CHECK(shadow.update("10", "A", true));
+    CHECK(shadow.size() == 1);
+    CHECK(!shadow.dirty(0));
+
+    // Pushed offline: dirty with the latest value
+    shadow.update("10", "B", false);
+    CHECK(shadow.dirty(0));
+    CHECK(shadow.value(0) == "B");
+    shadow.update("10", "A", false);
+    CHECK(shadow.dirty(0));
+    CHECK(shadow.value(0) == "A");
+    CHECK(shadow.dirtyCount() == 1);
+
+    // Delivered again: clean
+    shadow.update("10", "A", true);
+    CHECK(!shadow.dirty(0));
+    CHECK(shadow.dirtyCount() == 0);
+
+    // A failed publish of the same value still counts
+    shadow.update("10", "A", false);
+    CHECK(shadow.dirty(0));
+
+    // New keys take the next slot
+    shadow.update("11", "ON", false);
+    CHECK(shadow.key(1) == "11");
+    CHECK(shadow.dirtyCount() == 2);
+    shadow.markClean(0);
+    shadow.markClean(0);
+    CHECK(shadow.dirtyCount() == 1);
+    CHECK(!shadow.dirty(0) && shadow.dirty(1));
+}
+
+static void testCapacity() {
+    StateShadow shadow(40);
+    for (int i = 0; i < 40; i++) {
+        CHECK(shadow.update(String(i), "1", false));
+    }
+    CHECK(!shadow.update("40", "1", false));
+    CHECK(shadow.size() == 40);
+    CHECK(shadow.dirtyCount() == 40);
+
+    // Slots past the first bitmap word
+    CHECK(shadow.dirty(39));
+    shadow.markClean(39);
+    CHECK(!shadow.dirty(39) && shadow.dirty(38));
+    CHECK(shadow.dirtyCount() == 39);
+
+    // Known keys can still be updated when full
+    CHECK(shadow.update("39", "2", false));
+    CHECK(shadow.value(39) == "2");
+}
+
+int main() {
+    testDirty();
+    testCapacity();
+    return testResult("test_shadow");
+}
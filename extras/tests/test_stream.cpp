@@ -0,0 +1,136 @@
+// StreamingClient: chunked delivery, QoS 1 acknowledgement and pass-through
+#include "firmnginKit.h"
+#include "test.h"
+
+#include <string>
+#include <vector>
+
+// Network client over in-memory buffers, at most `burst` bytes readable at a time
+class MemoryClient : public Client {
+public:
+    std::vector<uint8_t> in;
+    size_t pos = 0;
+    size_t burst = SIZE_MAX;
+    std::vector<uint8_t> out;
+
+    int connect(IPAddress, uint16_t) override { return 1; }
+    int connect(const char*, uint16_t) override { return 1; }
+    size_t write(uint8_t c) override { out.push_back(c); return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { out.insert(out.end(), buffer, buffer + size); return size; }
+    int available() override { return (int)min(in.size() - pos, burst); }
+    int read() override { return pos < in.size() ? in[pos++] : -1; }
+    int read(uint8_t* buffer, size_t size) override {
+        size_t n = min(size, (size_t)available());
+        memcpy(buffer, in.data() + pos, n);
+        pos += n;
+        return n > 0 ? (int)n : -1;
+    }
+    int peek() override { return pos < in.size() ? in[pos] : -1; }
+    void flush() override {}
+    void stop() override {}
+    uint8_t connected() override { return 1; }
+    operator bool() override { return true; }
+};
+
+static std::vector<uint8_t> publish(const std::string& topic, const std::string& payload, uint8_t qos, uint16_t packetId) {
+    std::vector<uint8_t> packet;
+    packet.push_back(0x30 | (qos << 1));
+    size_t remaining = 2 + topic.size() + (qos ? 2 : 0) + payload.size();
+    do {
+        uint8_t b = remaining % 128;
+        remaining /= 128;
+        packet.push_back(remaining ? b | 0x80 : b);
+    } while (remaining);
+    packet.push_back(topic.size() >> 8);
+    packet.push_back(topic.size() & 0xFF);
+    packet.insert(packet.end(), topic.begin(), topic.end());
+    if (qos) {
+        packet.push_back(packetId >> 8);
+        packet.push_back(packetId & 0xFF);
+    }
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    return packet;
+}
+
+// Everything PubSubClient would read
+static std::vector<uint8_t> drain(StreamingClient& client) {
+    std::vector<uint8_t> passed;
+    while (client.available() > 0) {
+        passed.push_back((uint8_t)client.read());
+    }
+    return passed;
+}
+
+static void testChunks() {
+    MemoryClient network;
+    StreamingClient client(network);
+    std::string received;
+    size_t chunks = 0;
+    bool ordered = true;
+    client.add("/d/dev/cfg", [&](const uint8_t* data, size_t length, size_t offset, size_t total) {
+        ordered = ordered && offset == received.size() && total == 1000 && length <= STREAM_CHUNK_SIZE;
+        received.append((const char*)data, length);
+        chunks++;
+    });
+
+    std::string payload;
+    for (int i = 0; i < 1000; i++) payload += (char)('a' + i % 26);
+    network.in = publish("/d/dev/cfg", payload, 0, 0);
+    network.burst = 100;
+
+    // Arrives in bursts, each call hands on what is there
+    while (network.pos < network.in.size()) {
+        CHECK(drain(client).empty());
+        network.burst += 100;
+    }
+    CHECK(received == payload);
+    CHECK(ordered);
+    CHECK(chunks >= 1000 / STREAM_CHUNK_SIZE);
+    CHECK(network.out.empty());
+}
+
+static void testAcknowledge() {
+    MemoryClient network;
+    StreamingClient client(network);
+    int calls = 0;
+    client.add("/d/dev/cfg", [&](const uint8_t*, size_t, size_t, size_t) { calls++; });
+
+    network.in = publish("/d/dev/cfg", "{}", 1, 0x1234);
+    CHECK(drain(client).empty());
+    CHECK(calls == 1);
+    const uint8_t puback[] = { 0x40, 0x02, 0x12, 0x34 };
+    CHECK(network.out == std::vector<uint8_t>(puback, puback + 4));
+
+    // Empty payloads are reported once
+    network.in = publish("/d/dev/cfg", "", 0, 0);
+    network.pos = 0;
+    drain(client);
+    CHECK(calls == 2);
+}
+
+static void testPassThrough() {
+    MemoryClient network;
+    StreamingClient client(network);
+    int calls = 0;
+    client.add("/d/dev/cfg", [&](const uint8_t*, size_t, size_t, size_t) { calls++; });
+
+    // Other topics, QoS 2 and other packet types reach PubSubClient unchanged
+    std::vector<uint8_t> expected = publish("/d/dev/rs/5", "ON", 0, 0);
+    std::vector<uint8_t> qos2 = publish("/d/dev/cfg", "x", 2, 7);
+    expected.insert(expected.end(), qos2.begin(), qos2.end());
+    const uint8_t pingresp[] = { 0xD0, 0x00 };
+    expected.insert(expected.end(), pingresp, pingresp + 2);
+    std::vector<uint8_t> streamed = publish("/d/dev/cfg", "y", 0, 0);
+
+    network.in = expected;
+    network.in.insert(network.in.end(), streamed.begin(), streamed.end());
+    CHECK(drain(client) == expected);
+    CHECK(calls == 1);
+}
+
+int main() {
+    testChunks();
+    testAcknowledge();
+    testPassThrough();
+    return testResult("test_stream");
+}
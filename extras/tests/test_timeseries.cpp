@@ -0,0 +1,94 @@
+// TimeSeries: zigzag and varint encoding, block filling and drops
+#include "firmnginKit.h"
+#include "test.h"
+
+static uint64_t readVarint(const uint8_t*& in) {
+    uint64_t value = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+        uint8_t b = *in++;
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return value;
+    }
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void testZigzag() {
+    CHECK(TimeSeries::zigzag(0) == 0);
+    CHECK(TimeSeries::zigzag(-1) == 1);
+    CHECK(TimeSeries::zigzag(1) == 2);
+    CHECK(TimeSeries::zigzag(-2) == 3);
+    CHECK(TimeSeries::zigzag(INT32_MAX) == 0xFFFFFFFEULL);
+    CHECK(TimeSeries::zigzag(INT32_MIN) == 0xFFFFFFFFULL);
+    CHECK(TimeSeries::zigzag(INT64_MIN) == UINT64_MAX);
+}
+
+static void testVarint() {
+    uint8_t buffer[10];
+    CHECK(TimeSeries::writeVarint(buffer, 0) == buffer + 1 && buffer[0] == 0);
+    CHECK(TimeSeries::writeVarint(buffer, 127) == buffer + 1 && buffer[0] == 0x7F);
+    CHECK(TimeSeries::writeVarint(buffer, 300) == buffer + 2);
+    CHECK(buffer[0] == 0xAC && buffer[1] == 0x02);
+    CHECK(TimeSeries::writeVarint(buffer, UINT64_MAX) == buffer + 10);
+    CHECK(buffer[9] == 0x01);
+
+    // Round trip of the deltas a block can hold, int32 delta-of-delta included
+    const int64_t values[] = { 0, 1, -1, 63, -64, 64, 1000, -1000, INT32_MAX, INT32_MIN,
+                               (int64_t)INT32_MAX - INT32_MIN, (int64_t)INT32_MIN - INT32_MAX };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t* end = TimeSeries::writeVarint(buffer, TimeSeries::zigzag(values[i]));
+        CHECK(end - buffer <= 5);
+        const uint8_t* in = buffer;
+        CHECK(unzigzag(readVarint(in)) == values[i]);
+        CHECK(in == end);
+    }
+}
+
+// First value of a block, after the 14-byte header
+static int64_t firstValue(const uint8_t* block) {
+    const uint8_t* in = block + 14;
+    return unzigzag(readVarint(in));
+}
+
+static void testBlocks() {
+    // 100-byte blocks: header and first value 15 bytes, second sample 3,
+    // then 2 bytes per regular sample until less than 20 bytes are left.
+    // The first block holds value 1, the second value 2.
+    TimeSeries series(50, 100);
+    size_t length = 0;
+    uint32_t t = 0;
+    for (int i = 0; i < 68; i++) {
+        CHECK(series.record(i < 34 ? 1 : 2, t));
+        t += 1000;
+    }
+    CHECK(series.samples() == 68);
+    CHECK(series.dropped() == 0);
+    const uint8_t* block = series.nextBlock(length);
+    CHECK(block && firstValue(block) == 1);
+    CHECK(block[4] == 34 && block[5] == 0);
+    CHECK(length == 82);
+
+    // Both blocks sealed and nothing sent: new samples are dropped, and
+    // the send order stays the same after one and after two drops
+    CHECK(!series.record(3, t));
+    CHECK(series.dropped() == 1);
+    block = series.nextBlock(length);
+    CHECK(block && firstValue(block) == 1);
+    CHECK(!series.record(3, t + 1000));
+    CHECK(series.dropped() == 2);
+    block = series.nextBlock(length);
+    CHECK(block && firstValue(block) == 1);
+
+    // Without a connected instance nothing goes out and the blocks stay
+    CHECK(series.send() == 0);
+    CHECK(series.nextBlock(length) == block);
+}
+
+int main() {
+    testZigzag();
+    testVarint();
+    testBlocks();
+    return testResult("test_timeseries");
+}
@@ -0,0 +1,34 @@
+// VPinTraits: push thresholds for each value type
+#include "firmnginKit.h"
+#include "test.h"
+
+static void testIntegers() {
+    CHECK(VPinTraits<int>::moved(15, 10, 5));
+    CHECK(!VPinTraits<int>::moved(14, 10, 5));
+    CHECK(VPinTraits<int>::moved(5, 10, 5));
+
+    // A negative threshold is the same distance
+    CHECK(VPinTraits<int>::moved(15, 10, -5));
+    CHECK(!VPinTraits<int>::moved(14, 10, -5));
+    CHECK(VPinTraits<int16_t>::moved(-20, -10, -10));
+
+    // Extremes do not overflow
+    CHECK(VPinTraits<int32_t>::moved(INT32_MAX, INT32_MIN, INT32_MIN));
+    CHECK(!VPinTraits<int32_t>::moved(0, 1, INT32_MIN));
+}
+
+static void testFloatAndFixed() {
+    CHECK(VPinTraits<float>::moved(1.5f, 1.0f, 0.5f));
+    CHECK(VPinTraits<float>::moved(1.5f, 1.0f, -0.5f));
+    CHECK(!VPinTraits<float>::moved(1.2f, 1.0f, -0.5f));
+
+    typedef Fixed<2> Celsius;     // raw values in hundredths
+    CHECK(VPinTraits<Celsius>::moved(Celsius(2150), Celsius(2100), Celsius(-50)));
+    CHECK(!VPinTraits<Celsius>::moved(Celsius(2120), Celsius(2100), Celsius(-50)));
+}
+
+int main() {
+    testIntegers();
+    testFloatAndFixed();
+    return testResult("test_vpin");
+}
@@ -0,0 +1 @@
+../../src/firmnginKitStatic.h
\ No newline at end of file
@@ -1,6 +1,22 @@
 #include "firmnginKit.h"
 
-FirmnginKit* _globalFirmnginKitInstance = nullptr;
+// Set/clear registers for grouped GPIO writes (enableGroupedWrite)
+#if defined(ESP32) && defined(__has_include)
+#if __has_include(<soc/gpio_reg.h>)
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#define FNGIN_GPIO_REGISTERS
+#endif
+#endif
+
+// HMAC-SHA256 for the LAN control channel, from the platform TLS library
+#if defined(ESP8266)
+#include <bearssl/bearssl_hmac.h>
+#elif defined(ESP32)
+#include <mbedtls/md.h>
+#endif
+
+FNGIN_INSTANCE_STORAGE FirmnginKit* _globalFirmnginKitInstance = nullptr;
 
 const char *NTP_SERVER = "pool.ntp.org";
 int GMT_OFFSET_SEC = 7 * 3600;
@@ -41,6 +57,7 @@ FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey, const char
       _fingerprint(fingerprint)
 {
     _globalFirmnginKitInstance = this;
+    setMemoryBudget(MEMORY_BUDGET_BALANCED);
 }
 #elif defined(ESP32)
 FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey, const char* caCert, const char* clientCert, const char* privateKey)
@@ -57,6 +74,7 @@ FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey, const char
       _fingerprint(nullptr)
 {
     _globalFirmnginKitInstance = this;
+    setMemoryBudget(MEMORY_BUDGET_BALANCED);
 }
 
 FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey, const uint8_t* fingerprint, const char* clientCert, const char* privateKey)
@@ -73,6 +91,7 @@ FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey, const uint
       _fingerprint(fingerprint)
 {
     _globalFirmnginKitInstance = this;
+    setMemoryBudget(MEMORY_BUDGET_BALANCED);
 }
 #else
 FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey)
@@ -88,11 +107,188 @@ FirmnginKit::FirmnginKit(const char *deviceId, const char *deviceKey)
 }
 #endif
 
+// Each arena block is prefixed with its size so reallocate() can copy it,
+// the top bit marks a freed block until the arena rewinds past it
+static const size_t ARENA_ALIGN = sizeof(void*);
+static const size_t ARENA_HEADER = ARENA_ALIGN;
+static const size_t ARENA_FREED = ~((size_t)-1 >> 1);
+
+static size_t arenaAlign(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+FirmnginArena::~FirmnginArena() {
+    free(_buffer);
+}
+
+bool FirmnginArena::reserve(size_t size) {
+    if (_buffer && _size == size) return true;
+    if (_live > 0) return false;
+    free(_buffer);
+    _buffer = size ? (uint8_t*)malloc(size) : nullptr;
+    _size = _buffer ? size : 0;
+    _used = 0;
+    return _buffer != nullptr;
+}
+
+bool FirmnginArena::owns(const void* ptr) const {
+    return _buffer && ptr >= _buffer && ptr < _buffer + _size;
+}
+
+void* FirmnginArena::allocate(size_t size) {
+    size_t needed = ARENA_HEADER + arenaAlign(size);
+    if (!_buffer || _used + needed > _size) {
+        _fallbacks++;
+        return malloc(size);
+    }
+    uint8_t* block = _buffer + _used;
+    *(size_t*)block = size;
+    _used += needed;
+    _live++;
+    if (_used > _peak) _peak = _used;
+    return block + ARENA_HEADER;
+}
+
+void FirmnginArena::deallocate(void* ptr) {
+    if (!ptr) return;
+    if (!owns(ptr)) {
+        free(ptr);
+        return;
+    }
+    uint8_t* block = (uint8_t*)ptr - ARENA_HEADER;
+    size_t size = *(size_t*)block;
+    *(size_t*)block = size | ARENA_FREED;
+    if (--_live == 0) {
+        _used = 0;
+    } else if (block + ARENA_HEADER + arenaAlign(size) == _buffer + _used) {
+        // Freed the last block: rewind to the end of the highest live one, so
+        // a long-lived document (a BatchState) does not pin the whole arena
+        size_t end = 0;
+        for (size_t offset = 0; offset < _used; ) {
+            size_t header = *(size_t*)(_buffer + offset);
+            offset += ARENA_HEADER + arenaAlign(header & ~ARENA_FREED);
+            if (!(header & ARENA_FREED)) end = offset;
+        }
+        _used = end;
+    }
+}
+
+void* FirmnginArena::reallocate(void* ptr, size_t size) {
+    if (!ptr) return allocate(size);
+    if (!owns(ptr)) return realloc(ptr, size);
+
+    uint8_t* block = (uint8_t*)ptr - ARENA_HEADER;
+    size_t oldSize = *(size_t*)block;
+
+    // Last block: grow or shrink in place
+    if (block + ARENA_HEADER + arenaAlign(oldSize) == _buffer + _used &&
+        (size_t)(block - _buffer) + ARENA_HEADER + arenaAlign(size) <= _size) {
+        *(size_t*)block = size;
+        _used = (block - _buffer) + ARENA_HEADER + arenaAlign(size);
+        if (_used > _peak) _peak = _used;
+        return ptr;
+    }
+
+    void* moved = allocate(size);
+    if (moved) {
+        memcpy(moved, ptr, oldSize < size ? oldSize : size);
+        deallocate(ptr);
+    }
+    return moved;
+}
+
+// Free tail of the arena for serialized output, valid until the next allocate()
+char* FirmnginArena::scratch(size_t size) {
+    if (!_buffer || _used + size > _size) return nullptr;
+    if (_used + size > _peak) _peak = _used + size;
+    return (char*)(_buffer + _used);
+}
+
+SequenceWindow::SequenceWindow(size_t size)
+    : _buffer((uint8_t*)malloc(size)),
+      _size(_buffer ? size : 0)
+{
+}
+
+SequenceWindow::~SequenceWindow() {
+    free(_buffer);
+}
+
+void SequenceWindow::dropOldest() {
+    uint16_t length;
+    memcpy(&length, _buffer + _head + 5, sizeof(length));
+    _head += RECORD_HEADER + length;
+    if (_head == _tail) _head = _tail = 0;
+}
+
+bool SequenceWindow::store(uint32_t seq, uint8_t topic, const uint8_t* payload, size_t length) {
+    size_t needed = RECORD_HEADER + length;
+    if (needed > _size || length > 0xFFFF) return false;
+
+    while (_head != _tail && _size - (_tail - _head) < needed) {
+        dropOldest();
+    }
+    if (_tail + needed > _size) {
+        memmove(_buffer, _buffer + _head, _tail - _head);
+        _tail -= _head;
+        _head = 0;
+    }
+
+    uint8_t* record = _buffer + _tail;
+    uint16_t length16 = length;
+    memcpy(record, &seq, sizeof(seq));
+    record[4] = topic;
+    memcpy(record + 5, &length16, sizeof(length16));
+    memcpy(record + RECORD_HEADER, payload, length);
+    _tail += needed;
+    return true;
+}
+
+void SequenceWindow::forEach(uint32_t from, uint32_t to, const Visitor& visit) const {
+    size_t pos = _head;
+    while (pos < _tail) {
+        uint32_t seq;
+        uint16_t length;
+        memcpy(&seq, _buffer + pos, sizeof(seq));
+        memcpy(&length, _buffer + pos + 5, sizeof(length));
+        if (seq >= from && seq <= to) {
+            visit(seq, _buffer[pos + 4], _buffer + pos + RECORD_HEADER, length);
+        }
+        pos += RECORD_HEADER + length;
+    }
+}
+
+uint32_t SequenceWindow::oldest() const {
+    if (_head == _tail) return 0;
+    uint32_t seq;
+    memcpy(&seq, _buffer + _head, sizeof(seq));
+    return seq;
+}
+
 FirmnginKit::~FirmnginKit() {
 #if defined(ESP8266)
     delete _clientCertList;
     delete _clientPrivKey;
+    delete _caCertList;
+#elif defined(ESP32)
+    free(_caCertPem);
+    free(_clientCertPem);
+    free(_privateKeyPem);
 #endif
+    delete _sequenceWindow;
+    delete _latencyTracer;
+    delete _scheduler;
+    delete _edgeRules;
+    delete _eventLog;
+    delete _streamingClient;
+    delete _shadow;
+    for (std::map<String, JsonStreamParser*>::iterator parser = _streamParsers.begin(); parser != _streamParsers.end(); ++parser) {
+        delete parser->second;
+    }
+    if (_localUdp) {
+        _localUdp->stop();
+        delete _localUdp;
+    }
 }
 
 // Example: getPaymentSuccess("dev-1764691334-daa58e77") returns "/c/dev-1764691334-daa58e77/pm"
@@ -141,13 +337,164 @@ String FirmnginKit::getPushBatchStateTopic(String deviceId) {
     return String("/d/") + deviceId + "/psb";
 }
 
+// PEM checks read the credential in place (it may live in flash) instead of copying it into a String
+static bool pemContains(const char* pem, const char* marker) {
+    size_t markerLength = strlen(marker);
+    for (const char* p = pem; pgm_read_byte(p); p++) {
+        size_t i = 0;
+        while (i < markerLength && pgm_read_byte(p + i) == (uint8_t)marker[i]) i++;
+        if (i == markerLength) return true;
+    }
+    return false;
+}
+
+static bool pemHasMarkers(const char* pem, const char* begin, const char* end) {
+    return pemContains(pem, begin) && pemContains(pem, end);
+}
+
+// A DER credential is one ASN.1 SEQUENCE whose encoded length matches the array
+static bool derLooksValid(const uint8_t* der, size_t length) {
+    if (!der || length < 4 || pgm_read_byte(der) != 0x30) return false;
+
+    uint8_t first = pgm_read_byte(der + 1);
+    size_t header = 2;
+    size_t body = first;
+    if (first & 0x80) {
+        uint8_t lengthBytes = first & 0x7F;
+        if (lengthBytes == 0 || lengthBytes > 3) return false;
+        body = 0;
+        for (uint8_t i = 0; i < lengthBytes; i++) {
+            body = (body << 8) | pgm_read_byte(der + 2 + i);
+        }
+        header += lengthBytes;
+    }
+    return header + body == length;
+}
+
+// PEM label of a DER private key, from the element after its version:
+// PKCS#8 has an AlgorithmIdentifier SEQUENCE, PKCS#1 (RSA) the modulus
+// INTEGER and SEC1 (EC) the key OCTET STRING. nullptr for anything else.
+static const char* derPrivateKeyLabel(const uint8_t* der, size_t length) {
+    uint8_t first = pgm_read_byte(der + 1);
+    size_t pos = 2 + ((first & 0x80) ? (first & 0x7F) : 0);
+    if (pos + 4 > length || pgm_read_byte(der + pos) != 0x02 || pgm_read_byte(der + pos + 1) != 0x01) {
+        return nullptr;
+    }
+    switch (pgm_read_byte(der + pos + 3)) {
+        case 0x30: return "PRIVATE KEY";
+        case 0x02: return "RSA PRIVATE KEY";
+        case 0x04: return "EC PRIVATE KEY";
+        default: return nullptr;
+    }
+}
+
+#if defined(ESP32)
+// Base64 PEM block for WiFiClientSecure, which has no DER setters
+static char* derToPem(const uint8_t* der, size_t length, const char* label) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t encoded = (length + 2) / 3 * 4;
+    size_t size = encoded + encoded / 64 + 2 * strlen(label) + 40;
+    char* pem = (char*)malloc(size);
+    if (!pem) return nullptr;
+
+    char* out = pem + sprintf(pem, "-----BEGIN %s-----\n", label);
+    size_t column = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t chunk = (uint32_t)der[i] << 16;
+        if (i + 1 < length) chunk |= (uint32_t)der[i + 1] << 8;
+        if (i + 2 < length) chunk |= der[i + 2];
+        *out++ = alphabet[(chunk >> 18) & 0x3F];
+        *out++ = alphabet[(chunk >> 12) & 0x3F];
+        *out++ = i + 1 < length ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < length ? alphabet[chunk & 0x3F] : '=';
+        column += 4;
+        if (column == 64) {
+            *out++ = '\n';
+            column = 0;
+        }
+    }
+    if (column) *out++ = '\n';
+    sprintf(out, "-----END %s-----\n", label);
+    return pem;
+}
+#endif
+
+// Binary time-series blocks (see TimeSeries)
+String FirmnginKit::getTimeSeriesTopic(String deviceId) {
+    return String("/d/") + deviceId + "/ts";
+}
+
+// Latency reports from publishLatencyReport()
+String FirmnginKit::getLatencyTopic(String deviceId) {
+    return String("/d/") + deviceId + "/lat";
+}
+
+// Server requests missing sequence numbers here, payload "from-to" or "seq"
+String FirmnginKit::getRetransmitTopic(String deviceId) {
+    return String("/d/") + deviceId + "/rt";
+}
+
+// Sequence ranges no longer in the retransmit window are reported here
+String FirmnginKit::getGapTopic(String deviceId) {
+    return String("/d/") + deviceId + "/gap";
+}
+
+// Topic: /d/{deviceId}/rb
+String FirmnginKit::getBulkTopic(String deviceId) {
+    return String("/d/") + deviceId + "/rb";
+}
+
+// Topic: /d/{deviceId}/echo
+String FirmnginKit::getEchoTopic(String deviceId) {
+    return String("/d/") + deviceId + "/echo";
+}
+
+// Rule table from the server, payload like "10>30:5=1;10<28:5=0" (see EdgeRules)
+String FirmnginKit::getRulesTopic(String deviceId) {
+    return String("/d/") + deviceId + "/rules";
+}
+
+// Rule firings and rule load results
+String FirmnginKit::getRuleFiringTopic(String deviceId) {
+    return String("/d/") + deviceId + "/rf";
+}
+
+// Binary ring log from publishEventLog()
+String FirmnginKit::getEventLogTopic(String deviceId) {
+    return String("/d/") + deviceId + "/log";
+}
+
+// Changed states after a reconnect, and snapshots: {"states":{"10":"25.5",...}}
+String FirmnginKit::getStateDeltaTopic(String deviceId) {
+    return String("/d/") + deviceId + "/psd";
+}
+
+// Any message here requests a full snapshot on /psd
+String FirmnginKit::getStateRequestTopic(String deviceId) {
+    return String("/d/") + deviceId + "/sr";
+}
+
+// Matches /d/{deviceId}{suffix} without building the topic string
+bool FirmnginKit::isDeviceTopic(const char* topic, const char* suffix) {
+    size_t idLength = strlen(_deviceId);
+    return strncmp(topic, "/d/", 3) == 0 &&
+           strncmp(topic + 3, _deviceId, idLength) == 0 &&
+           strcmp(topic + 3 + idLength, suffix) == 0;
+}
+
 void FirmnginKit::begin() {
     if (!PLATFORM_SUPPORTED) return;
 
-    printBanner();
+    _beginMillis = millis();
+
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        printBanner();
+    }
 
     if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("ERROR: WiFi not connected");
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("ERROR: WiFi not connected");
+        }
         delay(2000);
         ESP.restart();
         return;
@@ -159,7 +506,7 @@ void FirmnginKit::begin() {
     time_t now = time(nullptr);
     struct tm timeinfo;
     if (localtime_r(&now, &timeinfo)) {
-        if (_debug) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
             Serial.print("System time: ");
             Serial.print(timeinfo.tm_year + 1900);
             Serial.print("-");
@@ -175,124 +522,406 @@ void FirmnginKit::begin() {
         }
         // Check if time is reasonable (after 2020)
         if (timeinfo.tm_year < 120) {
-            Serial.println("WARNING: System time may not be synced correctly!");
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+                Serial.println("WARNING: System time may not be synced correctly!");
+            }
         }
     }
     
-    if (_debug) {
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
         Serial.print("MQTT Server: ");
         Serial.print(_mqttServer);
         Serial.print(":");
         Serial.println(_mqttPort);
     }
 
+    unsigned long tlsStart = millis();
+    uint32_t heapBefore = ESP.getFreeHeap();
+
 #if defined(ESP8266)
-    Serial.println("Configuring TLS...");
-    
-    // Validate client certificate and private key
-    if (!_clientCert || strlen(_clientCert) < 50 || !_privateKey || strlen(_privateKey) < 50) {
-        Serial.println("ERROR: Client certificate and private key are required but empty or invalid");
-        return;
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.println("Configuring TLS...");
     }
     
-    // Validate certificate format
-    String clientCertStr = String(_clientCert);
-    String privateKeyStr = String(_privateKey);
-    if (clientCertStr.indexOf("-----BEGIN CERTIFICATE-----") == -1 ||
-        clientCertStr.indexOf("-----END CERTIFICATE-----") == -1) {
-        Serial.println("ERROR: Client certificate format invalid (missing BEGIN/END markers)");
-        return;
+    if (_clientCertDer && _privateKeyDer) {
+        // Pre-decoded DER: no PEM/base64 parsing at boot
+        if (!derLooksValid(_clientCertDer, _clientCertDerLength)) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Client certificate DER invalid");
+            }
+            return;
+        }
+        if (!derLooksValid(_privateKeyDer, _privateKeyDerLength) || !derPrivateKeyLabel(_privateKeyDer, _privateKeyDerLength)) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Private key DER invalid");
+            }
+            return;
+        }
+        _clientCertList = new BearSSL::X509List(_clientCertDer, _clientCertDerLength);
+
+        // The key decoder reads its input byte by byte, which flash does not
+        // allow on ESP8266, so it gets a short-lived RAM copy
+        uint8_t* keyCopy = (uint8_t*)malloc(_privateKeyDerLength);
+        if (!keyCopy) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Not enough memory for private key");
+            }
+            return;
+        }
+        memcpy_P(keyCopy, _privateKeyDer, _privateKeyDerLength);
+        _clientPrivKey = new BearSSL::PrivateKey(keyCopy, _privateKeyDerLength);
+        free(keyCopy);
+    } else {
+        // Validate client certificate and private key
+        if (!_clientCert || strlen_P(_clientCert) < 50 || !_privateKey || strlen_P(_privateKey) < 50) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Client certificate and private key are required but empty or invalid");
+            }
+            return;
+        }
+        
+        // Validate certificate format
+        if (!pemHasMarkers(_clientCert, "-----BEGIN CERTIFICATE-----", "-----END CERTIFICATE-----")) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Client certificate format invalid (missing BEGIN/END markers)");
+            }
+            return;
+        }
+        if (!pemHasMarkers(_privateKey, "-----BEGIN", "-----END")) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Private key format invalid (missing BEGIN/END markers)");
+            }
+            return;
+        }
+        
+        _clientCertList = new BearSSL::X509List(_clientCert);
+        _clientPrivKey = new BearSSL::PrivateKey(_privateKey);
     }
-    if (privateKeyStr.indexOf("-----BEGIN") == -1 ||
-        privateKeyStr.indexOf("-----END") == -1) {
-        Serial.println("ERROR: Private key format invalid (missing BEGIN/END markers)");
+    _wifiClient.setClientRSACert(_clientCertList, _clientPrivKey);
+    _wifiClient.setBufferSizes(_tlsRxBufferSize, _tlsTxBufferSize);
+
+    // Server validation: trust anchor built from CA DER, else fingerprint
+    if (_caCertDer) {
+        if (!derLooksValid(_caCertDer, _caCertDerLength)) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: CA certificate DER invalid");
+            }
+            return;
+        }
+        _caCertList = new BearSSL::X509List(_caCertDer, _caCertDerLength);
+        _wifiClient.setTrustAnchors(_caCertList);
+    } else if (_fingerprint) {
+        _wifiClient.setFingerprint(_fingerprint);
+    } else {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("ERROR: Server fingerprint is required but empty or invalid");
+        }
         return;
     }
-    
-    // Validate fingerprint
-    if (!_fingerprint) {
-        Serial.println("ERROR: Server fingerprint is required but empty or invalid");
+#elif defined(ESP32)
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.println("Configuring TLS...");
+    }
+
+    // DER credentials are checked here and encoded to PEM around each connect
+    // (see attachDerCredentials), so they take no heap in between
+    if (_caCertDer && !derLooksValid(_caCertDer, _caCertDerLength)) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("ERROR: CA certificate DER invalid");
+        }
         return;
     }
-    
-    _clientCertList = new BearSSL::X509List(_clientCert);
-    _clientPrivKey = new BearSSL::PrivateKey(_privateKey);
-    _wifiClient.setClientRSACert(_clientCertList, _clientPrivKey);
-    _wifiClient.setBufferSizes(512, 512);
-    _wifiClient.setFingerprint(_fingerprint);
-#elif defined(ESP32)
-    Serial.println("Configuring TLS...");
+    bool clientDer = _clientCertDer && _privateKeyDer;
+    if (clientDer) {
+        if (!derLooksValid(_clientCertDer, _clientCertDerLength)) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Client certificate DER invalid");
+            }
+            return;
+        }
+        if (!derLooksValid(_privateKeyDer, _privateKeyDerLength) || !derPrivateKeyLabel(_privateKeyDer, _privateKeyDerLength)) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Private key DER invalid");
+            }
+            return;
+        }
+    }
 
     // Configure Root CA for server verification
-    if (_caCert && strlen(_caCert) > 50) {
+    if (_caCertDer) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
+            Serial.println("Root CA certificate (DER) set for server verification");
+        }
+    } else if (_caCert && strlen(_caCert) > 50) {
         // Validate certificate format
-        String caCertStr = String(_caCert);
-        if (caCertStr.indexOf("-----BEGIN CERTIFICATE-----") == -1 ||
-            caCertStr.indexOf("-----END CERTIFICATE-----") == -1) {
-            Serial.println("ERROR: CA certificate format invalid (missing BEGIN/END markers)");
+        if (!pemHasMarkers(_caCert, "-----BEGIN CERTIFICATE-----", "-----END CERTIFICATE-----")) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: CA certificate format invalid (missing BEGIN/END markers)");
+            }
             return;
         }
         _wifiClient.setCACert(_caCert);
-        if (_debug) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
             Serial.println("Root CA certificate set for server verification");
         }
     } else if (_fingerprint) {
         _wifiClient.setInsecure();
     } else {
-        Serial.println("ERROR: Either CA certificate or fingerprint is required");
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("ERROR: Either CA certificate or fingerprint is required");
+        }
         return;
     }
 
-    // Configure client certificate and private key for mTLS
-    if (_clientCert && strlen(_clientCert) > 50 && _privateKey && strlen(_privateKey) > 50) {
+    // Configure client certificate and private key for mTLS. Only the
+    // fingerprint setup above skips server verification: setInsecure()
+    // here would also override a configured CA.
+    if (clientDer) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
+            Serial.println("Client certificate and private key (DER) set for TLS authentication");
+        }
+    } else if (_clientCert && strlen(_clientCert) > 50 && _privateKey && strlen(_privateKey) > 50) {
         // Validate certificate format
-        String clientCertStr = String(_clientCert);
-        String privateKeyStr = String(_privateKey);
-        if (clientCertStr.indexOf("-----BEGIN CERTIFICATE-----") == -1 ||
-            clientCertStr.indexOf("-----END CERTIFICATE-----") == -1) {
-            Serial.println("ERROR: Client certificate format invalid (missing BEGIN/END markers)");
+        if (!pemHasMarkers(_clientCert, "-----BEGIN CERTIFICATE-----", "-----END CERTIFICATE-----")) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Client certificate format invalid (missing BEGIN/END markers)");
+            }
             return;
         }
-        if (privateKeyStr.indexOf("-----BEGIN") == -1 ||
-            privateKeyStr.indexOf("-----END") == -1) {
-            Serial.println("ERROR: Private key format invalid (missing BEGIN/END markers)");
+        if (!pemHasMarkers(_privateKey, "-----BEGIN", "-----END")) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("ERROR: Private key format invalid (missing BEGIN/END markers)");
+            }
             return;
         }
-        // TODO: just for a while
-        _wifiClient.setInsecure();
         _wifiClient.setCertificate(_clientCert);
         _wifiClient.setPrivateKey(_privateKey);
-        if (_debug) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
             Serial.println("Client certificate and private key set for TLS authentication");
         }
     } else {
-        Serial.println("ERROR: Client certificate and private key are required but empty or invalid");
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("ERROR: Client certificate and private key are required but empty or invalid");
+        }
         return;
     }
 
     // Set TLS handshake timeout (30 seconds)
     _wifiClient.setTimeout(30);
 
-    Serial.println("TLS configuration completed");
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.println("TLS configuration completed");
+    }
 #endif
 
+    uint32_t heapAfter = ESP.getFreeHeap();
+    _credentialHeap = heapBefore > heapAfter ? heapBefore - heapAfter : 0;
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.print("TLS credentials: ");
+        Serial.print(millis() - tlsStart);
+        Serial.print(" ms, ");
+        Serial.print(_credentialHeap);
+        Serial.println(" bytes heap");
+    }
+
     _mqttClient.setServer(_mqttServer.c_str(), _mqttPort);
     _mqttClient.setCallback([this](char *topic, byte *payload, unsigned int length) {
         this->mqttCallback(topic, payload, length);
     });
-    _mqttClient.setBufferSize(2048);
-    _mqttClient.setKeepAlive(15);
+    _mqttClient.setBufferSize(_mqttBufferSize);
+    if (!_arena.reserve(_arenaSize)) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.println("WARNING: Could not reserve memory arena, using heap");
+        }
+    }
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.print("Memory budget: ");
+        Serial.print(_memoryBudget);
+        Serial.print(" (mqtt ");
+        Serial.print(_mqttBufferSize);
+        Serial.print(", tls ");
+        Serial.print(_tlsRxBufferSize);
+        Serial.print("/");
+        Serial.print(_tlsTxBufferSize);
+        Serial.print(", arena ");
+        Serial.print(_arenaSize);
+        Serial.println(")");
+    }
+    _mqttClient.setKeepAlive(DEFAULT_MQTT_KEEPALIVE);
     _mqttClient.setSocketTimeout(20);
 }
 
+// Pre-decoded credentials from extras/pem2der.py, used instead of the PEM ones. Call before begin().
+void FirmnginKit::setClientCertDer(const uint8_t* der, size_t length) {
+    _clientCertDer = der;
+    _clientCertDerLength = length;
+}
+
+void FirmnginKit::setPrivateKeyDer(const uint8_t* der, size_t length) {
+    _privateKeyDer = der;
+    _privateKeyDerLength = length;
+}
+
+void FirmnginKit::setCACertDer(const uint8_t* der, size_t length) {
+    _caCertDer = der;
+    _caCertDerLength = length;
+}
+
 void FirmnginKit::setMQTTServer(const char* server, int port) {
     _mqttServer = server;
     _mqttPort = port;
 }
 
+// Candidate brokers. With more than one, the fastest healthy endpoint is
+// used and connection failures move to the next one before restarting.
+// Example: addMQTTServer("asia-jkt1.firmngin.dev"); addMQTTServer("asia-sg1.firmngin.dev");
+bool FirmnginKit::addMQTTServer(const char* server, int port) {
+    if (_endpointCount >= MAX_MQTT_ENDPOINTS) return false;
+    BrokerEndpoint& endpoint = _endpoints[_endpointCount++];
+    endpoint.host = server;
+    endpoint.port = port;
+    endpoint.probeMs = 0;
+    endpoint.connectMs = 0;
+    endpoint.echoMs = 0;
+    endpoint.failures = 0;
+    endpoint.resolved = false;
+    return true;
+}
+
+// Every endpoint is probed once per interval, spread over the interval
+void FirmnginKit::setProbeInterval(unsigned long ms) {
+    _probeInterval = ms;
+}
+
+const BrokerEndpoint* FirmnginKit::getMQTTServer(uint8_t index) {
+    return index < _endpointCount ? &_endpoints[index] : nullptr;
+}
+
 void FirmnginKit::setClient(Client& client) {
     _externalClient = &client;
-    _mqttClient.setClient(client);
+    if (_streamingClient) {
+        _streamingClient->setInner(client);
+    }
+    if (!_streamingAttached) {
+        _mqttClient.setClient(client);
+    }
+}
+
+// Payloads on /d/{deviceId}/{topic} go to the callback in chunks of up to
+// STREAM_CHUNK_SIZE bytes as they arrive, whatever their size. They do not
+// need to fit the MQTT buffer. Example: onStream("cfg", ...) for /d/{deviceId}/cfg
+// The stream reader has to start at a packet boundary, so the first call
+// made while connected takes effect at the next reconnect.
+void FirmnginKit::onStream(const char* topic, StreamCallbackFunction callback) {
+    if (!_streamingClient) {
+        Client* inner = _externalClient ? _externalClient : &_wifiClient;
+        _streamingClient = new StreamingClient(*inner);
+    }
+    if (!_streamingAttached && !_mqttClient.connected()) {
+        _mqttClient.setClient(*_streamingClient);
+        _streamingAttached = true;
+    }
+    String fullTopic = String("/d/") + _deviceId + "/" + topic;
+    _streamingClient->add(fullTopic, callback);
+    if (!_streamingAttached) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.println("Stream: registered while connected, active after the next reconnect");
+        }
+    } else if (_mqttClient.connected()) {
+        _mqttClient.subscribe(fullTopic.c_str(), defaultQos);
+    }
+}
+
+// Same, with every chunk fed to an incremental JSON parser
+void FirmnginKit::onStreamJson(const char* topic, JsonStreamParser::Handler handler) {
+    JsonStreamParser*& parser = _streamParsers[String(topic)];
+    delete parser;
+    parser = new JsonStreamParser(handler);
+    JsonStreamParser* target = parser;
+    onStream(topic, [target](const uint8_t* data, size_t length, size_t offset, size_t total) {
+        if (offset == 0) target->reset();
+        target->feed(data, length);
+        // Ends a top-level number or literal that has no delimiter after it
+        if (offset + length == total) target->feed((const uint8_t*)" ", 1);
+    });
+}
+
+// Split one budget into TLS, MQTT and arena buffers. Call before begin().
+// setMemoryBudget(6144), the default, gives:
+//   ESP8266  tls 512/512, mqtt 2048, arena 3072
+//   ESP32    mqtt 2048, arena 4096 (mbedtls allocates its own TLS buffers)
+void FirmnginKit::setMemoryBudget(size_t bytes) {
+    _memoryBudget = bytes;
+    size_t remaining = bytes;
+
+#if defined(ESP8266)
+    // BearSSL buffers must be a valid max fragment length (512..4096)
+    if (bytes >= MEMORY_BUDGET_HIGH) {
+        _tlsRxBufferSize = 4096;
+        _tlsTxBufferSize = 1024;
+    } else if (bytes >= 8192) {
+        _tlsRxBufferSize = 1024;
+        _tlsTxBufferSize = 512;
+    } else {
+        _tlsRxBufferSize = 512;
+        _tlsTxBufferSize = 512;
+    }
+    size_t tls = _tlsRxBufferSize + _tlsTxBufferSize;
+    remaining = remaining > tls ? remaining - tls : 0;
+#else
+    _tlsRxBufferSize = 0;
+    _tlsTxBufferSize = 0;
+#endif
+
+    // MQTT buffer only holds inbound messages and small publishes,
+    // larger outbound payloads are streamed from the arena. The shares keep
+    // the 2048-byte buffer of previous releases for MEMORY_BALANCED.
+#if defined(ESP8266)
+    size_t mqtt = (remaining * 2 / 5) & ~(size_t)63;
+#else
+    size_t mqtt = (remaining / 3) & ~(size_t)63;
+#endif
+    mqtt = constrain(mqtt, (size_t)256, (size_t)8192);
+    _mqttBufferSize = mqtt;
+
+    size_t arena = remaining > mqtt ? remaining - mqtt : 0;
+    _arenaSize = max(arena, (size_t)256);
+
+    // Two thirds for the document, the rest for its serialized output
+    _batchCapacity = _arenaSize * 2 / 3;
+}
+
+void FirmnginKit::setMemoryProfile(MemoryProfile profile) {
+    switch (profile) {
+        case MEMORY_LOW: setMemoryBudget(MEMORY_BUDGET_LOW); break;
+        case MEMORY_HIGH: setMemoryBudget(MEMORY_BUDGET_HIGH); break;
+        default: setMemoryBudget(MEMORY_BUDGET_BALANCED); break;
+    }
+}
+
+MemoryStats FirmnginKit::getMemoryStats() {
+    MemoryStats stats;
+    stats.budget = _memoryBudget;
+    stats.mqttBuffer = _mqttBufferSize;
+    stats.tlsRxBuffer = _tlsRxBufferSize;
+    stats.tlsTxBuffer = _tlsTxBufferSize;
+    stats.arenaSize = _arena.size() ? _arena.size() : _arenaSize;
+    stats.batchCapacity = _batchCapacity;
+    stats.arenaPeak = _arena.peak();
+    stats.payloadPeak = _payloadPeak;
+    stats.arenaFallbacks = _arena.fallbacks();
+    stats.credentialHeap = _credentialHeap;
+    return stats;
+}
+
+// Opt-in: every /ps and /psb message carries a "seq" number and the last
+// windowBytes of them are kept for retransmission on request. Sequence
+// numbers restart at 1 after a reboot.
+//   /ps  -> {"key":"10","value":"25.5","seq":42}
+//   /psb -> {"seq":43,"states":[{"key":"10","value":"25.5"}, ...]}
+void FirmnginKit::enableSequencing(size_t windowBytes) {
+    delete _sequenceWindow;
+    _sequenceWindow = new SequenceWindow(windowBytes);
 }
 
 void FirmnginKit::setTimezone(int timezone) {
@@ -309,7 +938,7 @@ void FirmnginKit::setDaylightOffsetSec(int daylightOffsetSec) {
 }
 
 void FirmnginKit::syncTime() {
-    if (_debug) {
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
         Serial.print("Syncing time from NTP server: ");
         Serial.println(NTP_SERVER);
     }
@@ -326,13 +955,155 @@ void FirmnginKit::syncTime() {
         timeout++;
     }
     
+    FNGIN_EVENT(FNGIN_LOG_INFO, LOG_TIME_SYNC, now >= 1577836800, 0);
     if (now < 1577836800) {
-        Serial.println("WARNING: Time sync may have failed, certificate validation might fail!");
-    } else if (_debug) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.println("WARNING: Time sync may have failed, certificate validation might fail!");
+        }
+    } else if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
         Serial.println("Time synchronized");
     }
 }
 
+// NTP-disciplined wall clock, 0 until syncTime() has set the time
+uint64_t FirmnginKit::epochMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    if (tv.tv_sec < 1577836800) return 0;
+    return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+// Opt-in: outbound messages go through priority lanes (control > state > bulk)
+// with per-lane rate limits, queued messages are sent from loop().
+// Defaults: control unlimited, state 10 msg/s 4 KB/s, bulk 2 msg/s 2 KB/s
+void FirmnginKit::enableScheduler(uint8_t queueDepth) {
+    if (_scheduler) return;
+    _scheduler = new OutboundScheduler(queueDepth,
+        [this](const char* topic, const uint8_t* payload, size_t length, bool retained) {
+            return _mqttClient.connected() && publishNow(topic, payload, length, retained);
+        });
+    _scheduler->setRate(LANE_STATE, 10, 4096);
+    _scheduler->setRate(LANE_BULK, 2, 2048);
+}
+
+// 0 means unlimited. Example: setLaneRate(LANE_BULK, 5, 8192)
+void FirmnginKit::setLaneRate(OutboundLane lane, float messagesPerSec, uint32_t bytesPerSec) {
+    if (_scheduler && lane < LANE_COUNT) {
+        _scheduler->setRate(lane, messagesPerSec, bytesPerSec);
+    }
+}
+
+// Opt-in: outbound messages are held and released in windows so the radio
+// can sleep in between. Windows repeat every keepalive/3 (5 s with the default
+// 15 s keepalive), or more often when maxLatencyMs is lower, so a ping always
+// falls into a window before the broker's 1.5x keepalive timeout.
+// LANE_CONTROL messages (endSession) are still sent right away, downstream
+// messages are only read inside windows. lightSleep: ESP8266 light sleep, max
+// modem sleep on ESP32.
+void FirmnginKit::enableTransmitWindows(uint32_t maxLatencyMs, bool lightSleep) {
+    enableScheduler();
+    uint32_t keepAliveMs = DEFAULT_MQTT_KEEPALIVE * 1000UL;
+    uint32_t windows = maxLatencyMs ? (keepAliveMs + maxLatencyMs - 1) / maxLatencyMs : 3;
+    if (windows < 3) windows = 3;
+    _windowPeriod = keepAliveMs / windows;
+    _lightSleep = lightSleep;
+    _transmitWindows = true;
+    _windowOpen = false;
+    _windowStart = millis();
+    _windowClosed = _windowStart;
+    _scheduler->hold(true);
+    setRadioSleep(true);
+}
+
+RadioStats FirmnginKit::getRadioStats() {
+    RadioStats stats = {};
+    stats.windows = _windowCount;
+    stats.windowPeriodMs = _windowPeriod;
+    stats.awakeMs = _awakeMs;
+    stats.sleepMs = _sleepMs;
+    stats.maxHeldMs = _scheduler ? _scheduler->maxWait() : 0;
+    uint64_t total = (uint64_t)_awakeMs + _sleepMs;
+    if (!_transmitWindows || total == 0) {
+        stats.onMsPerHour = 3600000UL;
+    } else {
+        uint64_t on = (uint64_t)_awakeMs * 1000 + (uint64_t)_sleepMs * RADIO_SLEEP_DUTY_PERMILLE;
+        stats.onMsPerHour = (uint32_t)(on * 3600 / total);
+    }
+    return stats;
+}
+
+void FirmnginKit::openTransmitWindow(unsigned long now) {
+    _sleepMs += now - _windowClosed;
+    // Keep the phase unless a window was missed entirely
+    _windowStart = (now - _windowStart < 2 * _windowPeriod) ? _windowStart + _windowPeriod : now;
+    _windowOpenedAt = now;
+    _windowOpen = true;
+    _windowCount++;
+    setRadioSleep(false);
+    _scheduler->hold(false);
+}
+
+void FirmnginKit::closeTransmitWindow(unsigned long now) {
+    _awakeMs += now - _windowOpenedAt;
+    _windowClosed = now;
+    _windowOpen = false;
+    _scheduler->hold(true);
+    setRadioSleep(true);
+}
+
+void FirmnginKit::setRadioSleep(bool sleep) {
+#if defined(ESP8266)
+    WiFi.setSleepMode(sleep ? (_lightSleep ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP) : WIFI_NONE_SLEEP);
+#elif defined(ESP32)
+    // No WiFi light sleep on ESP32 without power management: max modem sleep
+    // also skips DTIM beacons, up to the AP's listen interval
+    WiFi.setSleep(sleep ? (_lightSleep ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM) : WIFI_PS_NONE);
+#endif
+}
+
+LaneStats FirmnginKit::getLaneStats(OutboundLane lane) {
+    LaneStats empty = {};
+    if (!_scheduler || lane >= LANE_COUNT) return empty;
+    return _scheduler->stats(lane);
+}
+
+// Opt-in: downstream messages carrying a server timestamp are timed from
+// server send to callback completion, per route, in fixed memory (~1 KB)
+void FirmnginKit::enableLatencyTracing() {
+    if (!_latencyTracer) {
+        _latencyTracer = new LatencyTracer();
+    }
+}
+
+LatencyStats FirmnginKit::getLatencyStats(TraceRoute route) {
+    LatencyStats empty = {};
+    if (!_latencyTracer || route >= TRACE_ROUTE_COUNT) return empty;
+    return _latencyTracer->stats(route);
+}
+
+int32_t FirmnginKit::getClockOffset() {
+    return _latencyTracer ? _latencyTracer->clockOffset() : 0;
+}
+
+// Example: {"offset":0,"routes":{"pm":{"n":12,"p50":180,"p99":420,"max":455,"h50":900,"h99":2100}, ...}}
+String FirmnginKit::exportLatency() {
+    String json;
+    if (!_latencyTracer) return json;
+    ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(TRACE_ROUTE_COUNT) +
+                                   TRACE_ROUTE_COUNT * JSON_OBJECT_SIZE(6));
+    _latencyTracer->exportJson(doc);
+    serializeJson(doc, json);
+    return json;
+}
+
+bool FirmnginKit::publishLatencyReport() {
+    if (!_latencyTracer || !_mqttClient.connected()) return false;
+    ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(TRACE_ROUTE_COUNT) +
+                                   TRACE_ROUTE_COUNT * JSON_OBJECT_SIZE(6));
+    _latencyTracer->exportJson(doc);
+    return publishJson(getLatencyTopic(_deviceId), doc, SEQ_NONE, LANE_BULK);
+}
+
 void FirmnginKit::onStateMonetize(DeviceStateType state, StateCallbackFunction callback) {
     _stateCallbacks[String(STATE_NAMES[state])] = callback;
 }
@@ -353,35 +1124,128 @@ void FirmnginKit::registerVirtualPin(int pinId, VirtualPinCallbackFunction callb
     _virtualPinCallbacks[pinId] = callback;
 }
 
+// Bound pins take /d/{id}/rs/{vpin} and bulk frames without a callback in between
+void FirmnginKit::bindVPin(VPinBase& pin) {
+    VPinBase* bound = &pin;
+    _boundPins[pin.getVpin()] = bound;
+    _virtualPinCallbacks[pin.getVpin()] = [bound](String payload) {
+        bound->handle(payload);
+    };
+}
+
+// Bulk frames switch all bound digital pins in one register write
+// instead of one digitalWrite per pin
+void FirmnginKit::enableGroupedWrite(bool enabled) {
+    _groupedWrite = enabled;
+}
+
 void onVirtualPin(int pinId, VirtualPinCallbackFunction callback) {
     if (_globalFirmnginKitInstance) {
         _globalFirmnginKitInstance->onVirtualPin(pinId, callback);
     }
 }
 
-void FirmnginKit::pushState(String key, String value) {
-    if (!_mqttClient.connected()) {
-        if (_debug) {
-            Serial.println("Cannot push state: MQTT not connected");
-        }
-        return;
-    }
+// Local rules, e.g. defaults that work before the first connect.
+// Rules from /d/{id}/rules replace them.
+bool FirmnginKit::setRules(const char* rules) {
+    return loadRules(rules, strlen(rules));
+}
+
+bool FirmnginKit::loadRules(const char* rules, size_t length) {
+    if (!_edgeRules) {
+        if (length == 0) return true;
+        _edgeRules = new EdgeRules([this](int vpin, int32_t value) {
+            applyRuleAction(vpin, value);
+        });
+    }
+    bool compiled = _edgeRules->compile(rules, length);
+    FNGIN_EVENT(FNGIN_LOG_INFO, LOG_RULES_LOADED, _edgeRules->count(), compiled);
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.print(compiled ? "Rules loaded: " : "Invalid rules, keeping ");
+        Serial.println(_edgeRules->count());
+    }
+    return compiled;
+}
+
+// Called with every VPin sample and /rs/, /rb and LAN command value
+void FirmnginKit::evaluateRules(int vpin, float value) {
+    if (!_edgeRules || _edgeRules->count() == 0) return;
+    _edgeRules->evaluate(vpin, value, epochMillis());
+}
+
+// The new target value is mirrored to the cloud from loop(), like a LAN
+// command: actions can run inside the MQTT callback, whose buffer a publish
+// would overwrite
+void FirmnginKit::applyRuleAction(int vpin, int32_t value) {
+    std::map<int, VPinBase*>::iterator bound = _boundPins.find(vpin);
+    std::map<int, VirtualPinCallbackFunction>::iterator callback = _virtualPinCallbacks.find(vpin);
+    if (bound != _boundPins.end()) {
+        VPinBase* pin = bound->second;
+        if (pin->getMode() == PWM) {
+            pin->setValue(value);
+        } else {
+            pin->set(value != 0);
+        }
+    } else if (callback != _virtualPinCallbacks.end()) {
+        callback->second(String(value));
+    } else {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.print("No handler registered for rule target: ");
+            Serial.println(vpin);
+        }
+        return;
+    }
+    _localPending[vpin] = String(value);
+}
+
+// Firings are queued while the action runs and reported from loop()
+void FirmnginKit::publishRuleFirings() {
+    if (!_edgeRules) return;
+    String topic = getRuleFiringTopic(_deviceId);
+    RuleFiring firing;
+    while (_edgeRules->nextFiring(firing)) {
+        ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(6));
+        doc["rule"] = firing.rule;
+        doc["vpin"] = firing.target;
+        doc["value"] = firing.action;
+        doc["sample"] = firing.sample;
+        if (firing.released) {
+            doc["released"] = true;
+        }
+        if (firing.epochMs) {
+            doc["ts"] = firing.epochMs;
+        }
+        publishJson(topic, doc);
+    }
+}
+
+void FirmnginKit::pushState(String key, String value) {
+    if (!_mqttClient.connected()) {
+        if (_shadow) {
+            _shadow->update(key, value, false);
+        }
+        FNGIN_EVENT(FNGIN_LOG_WARN, LOG_PUSH_OFFLINE, key.toInt(), 0);
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.println("Cannot push state: MQTT not connected");
+        }
+        return;
+    }
 
     String topic = getPushStateTopic(_deviceId);
-#if ARDUINOJSON_VERSION_MAJOR >= 7
-    JsonDocument doc;
-#else
-    DynamicJsonDocument doc(512);
-#endif
+    ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(3) + key.length() + value.length() + 2);
     doc["key"] = key;
     doc["value"] = value;
+    if (_sequenceWindow) {
+        doc["seq"] = ++_sequence;
+    }
     
-    String payload;
-    serializeJson(doc, payload);
-    
-    bool published = _mqttClient.publish(topic.c_str(), payload.c_str());
+    SubmitResult result = submitJson(topic, doc, _sequenceWindow ? SEQ_PUSH_STATE : SEQ_NONE);
+    bool published = result != SUBMIT_DROPPED;
+    if (_shadow) {
+        _shadow->update(key, value, result == SUBMIT_SENT);
+    }
     
-    if (_debug) {
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
         if (!published) {
             Serial.print("Failed to push state: ");
             Serial.print(key);
@@ -425,10 +1289,15 @@ bool FirmnginKit::publishBatchState(String payload) {
         return false;
     }
 
-    String topic = getPushBatchStateTopic(_deviceId);
-    bool published = _mqttClient.publish(topic.c_str(), payload.c_str());
+    bool published;
+    if (_sequenceWindow) {
+        published = publishSequencedBatch(payload.c_str(), payload.length(), nullptr) != SUBMIT_DROPPED;
+    } else {
+        String topic = getPushBatchStateTopic(_deviceId);
+        published = publishBuffer(topic.c_str(), (const uint8_t*)payload.c_str(), payload.length());
+    }
     
-    if (_debug) {
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
         if (!published) {
             Serial.print("Failed to push batch state: ");
             Serial.println(payload);
@@ -437,6 +1306,165 @@ bool FirmnginKit::publishBatchState(String payload) {
     return published;
 }
 
+bool FirmnginKit::publishBatchState(const JsonDocument& doc) {
+    if (!_mqttClient.connected()) {
+        recordShadow(doc, false);
+        return false;
+    }
+
+    SubmitResult result;
+    if (_sequenceWindow) {
+        result = publishSequencedBatch(nullptr, measureJson(doc), &doc);
+    } else {
+        result = submitJson(getPushBatchStateTopic(_deviceId), doc);
+    }
+    bool published = result != SUBMIT_DROPPED;
+    // Queued messages may still be dropped, only sent ones count as delivered
+    recordShadow(doc, result == SUBMIT_SENT);
+
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+        if (!published) {
+            Serial.print("Failed to push batch state: ");
+            serializeJson(doc, Serial);
+            Serial.println();
+        }
+    }
+    return published;
+}
+
+// Serialize into the arena tail (heap if it does not fit) and submit
+SubmitResult FirmnginKit::submitJson(const String& topic, const JsonDocument& doc, SequencedTopic sequenced, OutboundLane lane) {
+    size_t length = measureJson(doc);
+    if (length > _payloadPeak) _payloadPeak = length;
+
+    char* heap = nullptr;
+    char* out = _arena.scratch(length + 1);
+    if (!out) {
+        out = heap = (char*)malloc(length + 1);
+        if (!out) return SUBMIT_DROPPED;
+    }
+    serializeJson(doc, out, length + 1);
+
+    if (sequenced != SEQ_NONE && _sequenceWindow) {
+        _sequenceWindow->store(_sequence, sequenced, (const uint8_t*)out, length);
+    }
+    SubmitResult result = submitBuffer(topic.c_str(), (const uint8_t*)out, length, lane);
+    free(heap);
+    return result;
+}
+
+// Sent or queued
+bool FirmnginKit::publishJson(const String& topic, const JsonDocument& doc, SequencedTopic sequenced, OutboundLane lane) {
+    return submitJson(topic, doc, sequenced, lane) != SUBMIT_DROPPED;
+}
+
+// Wraps a batch array as {"seq":N,"states":[...]}, either from serialized
+// json or from doc (then jsonLength is measureJson(doc))
+SubmitResult FirmnginKit::publishSequencedBatch(const char* json, size_t jsonLength, const JsonDocument* doc) {
+    char head[32];
+    size_t headLength = snprintf(head, sizeof(head), "{\"seq\":%lu,\"states\":", (unsigned long)++_sequence);
+    size_t length = headLength + jsonLength + 1;
+    if (length > _payloadPeak) _payloadPeak = length;
+
+    char* heap = nullptr;
+    char* out = _arena.scratch(length + 1);
+    if (!out) {
+        out = heap = (char*)malloc(length + 1);
+        if (!out) return SUBMIT_DROPPED;
+    }
+    memcpy(out, head, headLength);
+    if (doc) {
+        serializeJson(*doc, out + headLength, jsonLength + 1);
+    } else {
+        memcpy(out + headLength, json, jsonLength);
+    }
+    out[length - 1] = '}';
+
+    _sequenceWindow->store(_sequence, SEQ_PUSH_BATCH, (const uint8_t*)out, length);
+    SubmitResult result = submitBuffer(getPushBatchStateTopic(_deviceId).c_str(), (const uint8_t*)out, length);
+    free(heap);
+    return result;
+}
+
+// Republish requested sequence numbers still in the window, report the rest as a gap
+void FirmnginKit::handleRetransmitRequest(const String& payload) {
+    if (!_sequenceWindow) return;
+
+    int dash = payload.indexOf('-');
+    uint32_t from = strtoul(payload.c_str(), nullptr, 10);
+    uint32_t to = dash >= 0 ? strtoul(payload.c_str() + dash + 1, nullptr, 10) : from;
+    if (from == 0 || to < from) return;
+    // Nothing sent in the requested range yet: no gap, nothing to resend
+    if (to > _sequence) to = _sequence;
+    if (to < from) return;
+
+    uint32_t oldest = _sequenceWindow->oldest();
+    if (oldest == 0 || from < oldest) {
+        uint32_t gapEnd = oldest == 0 ? to : min(to, oldest - 1);
+        char gap[40];
+        int gapLength = snprintf(gap, sizeof(gap), "{\"from\":%lu,\"to\":%lu}", (unsigned long)from, (unsigned long)gapEnd);
+        publishBuffer(getGapTopic(_deviceId).c_str(), (const uint8_t*)gap, gapLength, LANE_CONTROL);
+    }
+
+    String stateTopic = getPushStateTopic(_deviceId);
+    String batchTopic = getPushBatchStateTopic(_deviceId);
+    _sequenceWindow->forEach(from, to, [&](uint32_t, uint8_t topic, const uint8_t* data, size_t length) {
+        const String& target = topic == SEQ_PUSH_BATCH ? batchTopic : stateTopic;
+        publishBuffer(target.c_str(), data, length);
+    });
+
+    FNGIN_EVENT(FNGIN_LOG_INFO, LOG_RETRANSMIT, from, to);
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.print("Retransmit requested: ");
+        Serial.println(payload);
+    }
+}
+
+// All outbound messages go through here, queued per lane when the scheduler is enabled
+SubmitResult FirmnginKit::submitBuffer(const char* topic, const uint8_t* payload, size_t length, OutboundLane lane, bool retained) {
+    SubmitResult result;
+    if (_scheduler) {
+        result = _scheduler->submit(lane, topic, payload, length, retained);
+    } else {
+        result = publishNow(topic, payload, length, retained) ? SUBMIT_SENT : SUBMIT_DROPPED;
+    }
+    if (result == SUBMIT_DROPPED) {
+        FNGIN_EVENT(FNGIN_LOG_WARN, LOG_PUBLISH_FAILED, length, lane);
+    }
+    return result;
+}
+
+// Sent or queued
+bool FirmnginKit::publishBuffer(const char* topic, const uint8_t* payload, size_t length, OutboundLane lane, bool retained) {
+    return submitBuffer(topic, payload, length, lane, retained) != SUBMIT_DROPPED;
+}
+
+// Payloads that do not fit the MQTT buffer are streamed instead of copied
+bool FirmnginKit::publishNow(const char* topic, const uint8_t* payload, size_t length, bool retained) {
+    // fixed header (5) + topic length (2) + topic
+    if (length + strlen(topic) + 7 <= _mqttBufferSize) {
+        return _mqttClient.publish(topic, payload, length, retained);
+    }
+    if (!_mqttClient.beginPublish(topic, length, retained)) return false;
+    _mqttClient.write(payload, length);
+    return _mqttClient.endPublish() == 1;
+}
+
+bool FirmnginKit::publishTimeSeries(const uint8_t* block, size_t length) {
+    if (!_mqttClient.connected()) {
+        return false;
+    }
+    if (length > _payloadPeak) _payloadPeak = length;
+
+    bool published = publishBuffer(getTimeSeriesTopic(_deviceId).c_str(), block, length, LANE_BULK);
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN) && !published) {
+        Serial.print("Failed to push time-series block: ");
+        Serial.print(length);
+        Serial.println(" bytes");
+    }
+    return published;
+}
+
 BatchState FirmnginKit::pushBatchState() {
     return BatchState();
 }
@@ -448,68 +1476,434 @@ void FirmnginKit::setupLWT() {
 void FirmnginKit::loop() {
     if (!PLATFORM_SUPPORTED || WiFi.status() != WL_CONNECTED) return;
 
-    static unsigned long lastReconnectAttempt = 0;
-    static unsigned long backoffDelay = 5000;
+    // LAN commands do not wait for the broker, or for a transmit window
+    if (_localUdp) {
+        pollLocalControl();
+    }
 
     if (!_mqttClient.connected())
     {
+        if (_mqttWasConnected) {
+            _mqttWasConnected = false;
+            FNGIN_EVENT(FNGIN_LOG_WARN, LOG_MQTT_LOST, 0, _activeEndpoint);
+            // A lost connection counts against the broker, unless we left it
+            if (_activeEndpoint >= 0 && !_endpointSwitch) {
+                BrokerEndpoint& lost = _endpoints[_activeEndpoint];
+                if (lost.failures < 255) lost.failures++;
+                selectEndpoint(bestEndpoint());
+            }
+            _endpointSwitch = false;
+        }
         unsigned long now = millis();
-        if (now - lastReconnectAttempt > backoffDelay)
+        if (now - _lastReconnectAttempt > _backoffDelay)
         {
-            lastReconnectAttempt = now;
-            backoffDelay = min(backoffDelay * 2, 60000UL);
+            _lastReconnectAttempt = now;
+            _backoffDelay = min(_backoffDelay * 2, 60000UL);
             if (connectServer()) {
-                backoffDelay = 5000;
+                _backoffDelay = 5000;
+                _mqttWasConnected = true;
             }
+        } else {
+            probeEndpoints();
+        }
+    } else if (_transmitWindows) {
+        // Outside a window nothing is polled: inbound QoS 1 messages and
+        // keepalive pings would make the radio transmit. Downstream commands
+        // wait in the socket buffer for up to one window period.
+        unsigned long now = millis();
+        if (!_windowOpen) {
+            if (now - _windowStart < _windowPeriod) return;
+            openTransmitWindow(now);
+        }
+        _mqttClient.loop();
+        publishRuleFirings();
+        publishLocalState();
+        _scheduler->drain();
+        probeEndpoints();
+        unsigned long open = now - _windowOpenedAt;
+        if ((open >= TRANSMIT_WINDOW_MIN_MS && _scheduler->empty()) || open >= TRANSMIT_WINDOW_MAX_MS) {
+            closeTransmitWindow(now);
         }
     } else {
         _mqttClient.loop();
+        publishRuleFirings();
+        publishLocalState();
+        if (_scheduler) {
+            _scheduler->drain();
+        }
+        probeEndpoints();
     }
 }
 
-void FirmnginKit::_Debug(String message, bool newLine) {
-    if (_debug) {
-        if (newLine) Serial.println(message);
-        else Serial.print(message);
+// TCP connect time as a latency probe, the one measure every broker gets. A
+// TLS handshake per probe would need a second TLS client in RAM. The address
+// is cached so DNS does not block every probe; on ESP8266 the lookup shares
+// the probe timeout.
+bool FirmnginKit::probeEndpoint(BrokerEndpoint& endpoint) {
+    WiFiClient probe;
+    unsigned long start = millis();
+    if (!endpoint.resolved) {
+#if defined(ESP8266)
+        endpoint.resolved = WiFi.hostByName(endpoint.host.c_str(), endpoint.address, ENDPOINT_PROBE_TIMEOUT_MS) == 1;
+#else
+        endpoint.resolved = WiFi.hostByName(endpoint.host.c_str(), endpoint.address) == 1;
+#endif
+    }
+    bool reachable = false;
+    if (endpoint.resolved) {
+#if defined(ESP32)
+        reachable = probe.connect(endpoint.address, endpoint.port, ENDPOINT_PROBE_TIMEOUT_MS);
+#else
+        probe.setTimeout(ENDPOINT_PROBE_TIMEOUT_MS);
+        reachable = probe.connect(endpoint.address, endpoint.port);
+#endif
+    }
+    uint32_t elapsed = millis() - start;
+    probe.stop();
+
+    if (!reachable) {
+        if (endpoint.failures < 255) endpoint.failures++;
+        endpoint.resolved = false;
+    } else {
+        endpoint.probeMs = endpoint.probeMs ? (endpoint.probeMs * 3 + elapsed) / 4 : (elapsed ? elapsed : 1);
+        endpoint.failures = 0;
+    }
+    FNGIN_EVENT(FNGIN_LOG_DEBUG, LOG_ENDPOINT_PROBE, reachable ? (int32_t)elapsed : -1, &endpoint - _endpoints);
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
+        Serial.print("Probe ");
+        Serial.print(endpoint.host);
+        Serial.print(":");
+        Serial.print(endpoint.port);
+        Serial.print(reachable ? " " : " failed after ");
+        Serial.print(elapsed);
+        Serial.println(" ms");
+    }
+    return reachable;
+}
+
+// Lower is better. Every broker is ranked by its TCP connect time, the
+// active one included: the echo round trip goes through the broker and its
+// TLS session, so it is no match for a connect time. Unmeasured endpoints
+// rank after measured ones.
+uint32_t FirmnginKit::endpointScore(const BrokerEndpoint& endpoint) {
+    uint32_t latency = endpoint.probeMs ? endpoint.probeMs : ENDPOINT_PROBE_TIMEOUT_MS;
+    return latency + (uint32_t)endpoint.failures * ENDPOINT_FAILURE_PENALTY_MS;
+}
+
+int FirmnginKit::bestEndpoint() {
+    int best = -1;
+    for (uint8_t i = 0; i < _endpointCount; i++) {
+        if (best < 0 || endpointScore(_endpoints[i]) < endpointScore(_endpoints[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void FirmnginKit::selectEndpoint(int index) {
+    if (index < 0 || index >= _endpointCount) return;
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO) && index != _activeEndpoint) {
+        Serial.print("Using MQTT server ");
+        Serial.print(_endpoints[index].host);
+        Serial.print(":");
+        Serial.println(_endpoints[index].port);
+    }
+    _activeEndpoint = index;
+    _echoSentAt = 0;
+    _mqttServer = _endpoints[index].host;
+    _mqttPort = _endpoints[index].port;
+    // PubSubClient keeps the pointer, the endpoint string outlives it
+    _mqttClient.setServer(_endpoints[index].host.c_str(), _mqttPort);
+}
+
+// Probing costs a blocking TCP connect, so it is one endpoint per call and
+// only where it can pay off. While disconnected, the endpoints are probed in
+// turn, spread over the reconnect backoff, to rank them for failover. While
+// connected, the health of the active broker is checked with an echo through
+// the live connection; only while it is degraded (failures, a lost echo, or
+// an echo round trip above ENDPOINT_DEGRADED_MS) are all brokers probed, the
+// active one too, so the ranking compares connect times only. After such a
+// round, move to a clearly faster broker (25% margin).
+void FirmnginKit::probeEndpoints() {
+    if (_endpointCount < 2) return;
+    unsigned long now = millis();
+    bool connected = _mqttClient.connected();
+    unsigned long spacing = (connected ? _probeInterval : _backoffDelay) / _endpointCount;
+    if (now - _lastProbe < spacing) return;
+    _lastProbe = now;
+
+    uint8_t index = _probeCursor;
+    _probeCursor = (_probeCursor + 1) % _endpointCount;
+    if (!connected || _activeEndpoint < 0) {
+        probeEndpoint(_endpoints[index]);
+        return;
+    }
+
+    BrokerEndpoint& active = _endpoints[_activeEndpoint];
+    if (_echoSentAt) {
+        // No answer for a whole probe slot
+        if (active.failures < 255) active.failures++;
+        _echoSentAt = 0;
+    }
+    bool degraded = active.failures > 0 || active.echoMs > ENDPOINT_DEGRADED_MS;
+
+    if (index == _activeEndpoint) {
+        // Round trip through the broker on the live connection
+        char stamp[12];
+        _echoSentAt = millis();
+        snprintf(stamp, sizeof(stamp), "%lu", _echoSentAt);
+        publishNow(getEchoTopic(_deviceId).c_str(), (const uint8_t*)stamp, strlen(stamp), false);
+        if (degraded) {
+            // A reachable port does not clear lost echoes
+            uint8_t failures = active.failures;
+            probeEndpoint(active);
+            if (active.failures < failures) active.failures = failures;
+        }
+    } else if (degraded) {
+        probeEndpoint(_endpoints[index]);
+    }
+
+    if (_probeCursor == 0 && degraded) {
+        int best = bestEndpoint();
+        if (best != _activeEndpoint &&
+            endpointScore(_endpoints[best]) * 4 < endpointScore(active) * 3) {
+            FNGIN_EVENT(FNGIN_LOG_INFO, LOG_ENDPOINT_SWITCH, _activeEndpoint, best);
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+                Serial.println("Faster MQTT server found, switching");
+            }
+            _endpointSwitch = true;
+            _mqttClient.disconnect();
+            selectEndpoint(best);
+            _lastReconnectAttempt = now - _backoffDelay - 1;
+        }
     }
 }
 
+void FirmnginKit::handleEcho(const byte* payload, unsigned int length) {
+    if (!_echoSentAt || _activeEndpoint < 0) return;
+    unsigned long sent = (unsigned long)vpinParseInt((const char*)payload, length);
+    if (sent != _echoSentAt) return;
+    uint32_t rtt = millis() - sent;
+    BrokerEndpoint& endpoint = _endpoints[_activeEndpoint];
+    endpoint.echoMs = endpoint.echoMs ? (endpoint.echoMs * 3 + rtt) / 4 : (rtt ? rtt : 1);
+    endpoint.failures = 0;
+    _echoSentAt = 0;
+}
+
 void FirmnginKit::setDebug(bool debug) {
     _debug = debug;
 }
 
+// Records log events in RAM instead of printing them, so logging can stay
+// on without blocking on the UART. Read back with dumpLog() or publishEventLog().
+void FirmnginKit::enableEventLog(uint16_t records) {
+    if (_eventLog) return;
+    _eventLog = new EventLog(records);
+}
+
+void FirmnginKit::dumpLog(Print& out) {
+    if (_eventLog) {
+        _eventLog->dump(out);
+    }
+}
+
+// Records as stored, little-endian, 12 bytes each:
+// u32 millis, i32 a, i16 b, u8 event, u8 level
+bool FirmnginKit::publishEventLog() {
+    if (!_eventLog || _eventLog->size() == 0 || !_mqttClient.connected()) return false;
+    size_t length = _eventLog->size() * sizeof(EventLog::Record);
+    EventLog::Record* records = (EventLog::Record*)malloc(length);
+    if (!records) return false;
+    for (uint16_t i = 0; i < _eventLog->size(); i++) {
+        records[i] = _eventLog->at(i);
+    }
+    bool published = publishBuffer(getEventLogTopic(_deviceId).c_str(), (const uint8_t*)records, length, LANE_BULK);
+    free(records);
+    if (published) {
+        _eventLog->clear();
+    }
+    return published;
+}
+
+// Keeps the last value per key from pushState(), BatchState and VPin, so a
+// reconnect sends only what changed while offline (see publishShadow)
+void FirmnginKit::enableStateShadow(uint16_t maxKeys) {
+    if (_shadow) return;
+    _shadow = new StateShadow(maxKeys);
+}
+
+// BatchState array: [{"key":"10","value":"25.5"},...]
+void FirmnginKit::recordShadow(const JsonDocument& doc, bool delivered) {
+    if (!_shadow) return;
+    JsonArrayConst states = doc.as<JsonArrayConst>();
+    for (JsonVariantConst state : states) {
+        _shadow->update(state["key"].as<String>(), state["value"].as<String>(), delivered);
+    }
+}
+
+// Quoted JSON string length, escapes included
+static size_t jsonStringLength(const String& text) {
+    size_t length = text.length() + 2;
+    for (unsigned int i = 0; i < text.length(); i++) {
+        uint8_t c = text[i];
+        if (c == '"' || c == '\\') length += 1;
+        else if (c < 0x20) length += 5;
+    }
+    return length;
+}
+
+// Dirty keys (or all keys when full) on /d/{id}/psd, split so every
+// message fits the MQTT buffer:
+//   {"states":{"10":"25.5","11":"ON"}}
+//   {"full":true,"more":true,"states":{...}}   snapshot, "more" until the last part
+bool FirmnginKit::publishShadow(bool full) {
+    if (!_shadow || !_mqttClient.connected()) return false;
+    String topic = getStateDeltaTopic(_deviceId);
+    // Fixed header, topic and the wrapper object
+    size_t overhead = 8 + topic.length() + 40;
+    size_t buffer = _mqttClient.getBufferSize();
+    size_t limit = buffer > overhead + 32 ? buffer - overhead : 32;
+    uint16_t slot = 0;
+
+    while (slot < _shadow->size()) {
+        uint16_t first = slot;
+        uint16_t count = 0;
+        size_t length = 0;
+        for (; slot < _shadow->size(); slot++) {
+            if (!full && !_shadow->dirty(slot)) continue;
+            size_t pair = jsonStringLength(_shadow->key(slot)) + jsonStringLength(_shadow->value(slot)) + 2;
+            if (count > 0 && length + pair > limit) break;
+            length += pair;
+            count++;
+        }
+        if (count == 0) break;
+
+        ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(count));
+        JsonObject states = doc["states"].to<JsonObject>();
+        if (full) {
+            doc["full"] = true;
+            doc["more"] = slot < _shadow->size();
+        }
+        for (uint16_t i = first; i < slot; i++) {
+            if (full || _shadow->dirty(i)) {
+                // Stored by pointer, the shadow outlives the publish
+                states[_shadow->key(i).c_str()] = _shadow->value(i).c_str();
+            }
+        }
+
+        SubmitResult result = submitJson(topic, doc, SEQ_NONE, full ? LANE_BULK : LANE_STATE);
+        if (result == SUBMIT_DROPPED) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+                Serial.println("Failed to publish state shadow");
+            }
+            return false;
+        }
+        // A queued part can still be dropped by the scheduler, its keys
+        // stay dirty and go out again with the next reconnect
+        if (result == SUBMIT_SENT) {
+            for (uint16_t i = first; i < slot; i++) {
+                _shadow->markClean(i);
+            }
+        }
+    }
+    return true;
+}
+
 bool FirmnginKit::isPlatformSupported() {
     return PLATFORM_SUPPORTED;
 }
 
+#if defined(ESP32)
+// WiFiClientSecure only parses PEM and only reads it while connecting, so DER
+// credentials are encoded for each attempt and freed right after
+bool FirmnginKit::attachDerCredentials() {
+    if (_caCertDer) {
+        _caCertPem = derToPem(_caCertDer, _caCertDerLength, "CERTIFICATE");
+        if (!_caCertPem) return false;
+        _wifiClient.setCACert(_caCertPem);
+    }
+    if (_clientCertDer && _privateKeyDer) {
+        _clientCertPem = derToPem(_clientCertDer, _clientCertDerLength, "CERTIFICATE");
+        _privateKeyPem = derToPem(_privateKeyDer, _privateKeyDerLength, derPrivateKeyLabel(_privateKeyDer, _privateKeyDerLength));
+        if (!_clientCertPem || !_privateKeyPem) return false;
+        _wifiClient.setCertificate(_clientCertPem);
+        _wifiClient.setPrivateKey(_privateKeyPem);
+    }
+    return true;
+}
+
+void FirmnginKit::releaseDerCredentials() {
+    if (_caCertPem) _wifiClient.setCACert(nullptr);
+    if (_clientCertPem || _privateKeyPem) {
+        _wifiClient.setCertificate(nullptr);
+        _wifiClient.setPrivateKey(nullptr);
+    }
+    free(_caCertPem);
+    free(_clientCertPem);
+    free(_privateKeyPem);
+    _caCertPem = _clientCertPem = _privateKeyPem = nullptr;
+}
+#endif
+
 bool FirmnginKit::connectServer() {
     setupLWT();
-    
+
+    // Endpoints are tried in the order they were added until probes rank them
+    if (_endpointCount > 0 && _activeEndpoint < 0) {
+        selectEndpoint(0);
+    }
+
+    // With several brokers, one attempt each per call: loop() keeps failing
+    // over with its backoff instead of restarting the board
+    int maxAttempts = _endpointCount > 1 ? _endpointCount : maxRetryMQTT;
     int retryCount = 0;
-    while (!_mqttClient.connected() && retryCount < maxRetryMQTT)
+    while (!_mqttClient.connected() && retryCount < maxAttempts)
     {
         unsigned long now = millis();
         if (now - _lastMQTTAttempt >= _delayRetryMQTT)
         {
             _lastMQTTAttempt = now;
-            if (_debug) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
                 Serial.print("connecting to Server (");
                 Serial.print(retryCount + 1);
                 Serial.println(")");
             }
+            FNGIN_EVENT(FNGIN_LOG_INFO, LOG_MQTT_CONNECTING, retryCount + 1, _activeEndpoint);
             String willTopic = "/d/" + String(_deviceId) + "/lwt";
             String willMessage = "0";
             
-            if (_debug) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_DEBUG)) {
                 Serial.print("Attempting connection to server");
                 Serial.print(" with ");
                 Serial.println(_deviceId);
             }
             
             _mqttClient.disconnect();
+            if (_streamingClient && !_streamingAttached) {
+                _mqttClient.setClient(*_streamingClient);
+                _streamingAttached = true;
+            }
+            unsigned long connectStart = millis();
+#if defined(ESP32)
+            bool connected = false;
+            if (attachDerCredentials()) {
+                connected = _mqttClient.connect(_deviceId, willTopic.c_str(), 1, true, willMessage.c_str());
+            } else {
+                if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                    Serial.println("ERROR: Not enough memory for DER credentials");
+                }
+            }
+            releaseDerCredentials();
+#else
             bool connected = _mqttClient.connect(_deviceId, willTopic.c_str(), 1, true, willMessage.c_str());
+#endif
 
             if (connected) {
+                FNGIN_EVENT(FNGIN_LOG_INFO, LOG_MQTT_CONNECTED, millis() - connectStart, _activeEndpoint);
+                if (_activeEndpoint >= 0) {
+                    _endpoints[_activeEndpoint].connectMs = millis() - connectStart;
+                    _endpoints[_activeEndpoint].failures = 0;
+                }
                 _mqttClient.subscribe(getPaymentSuccess(_deviceId).c_str(), defaultQos);
                 _mqttClient.subscribe(getDeviceStatus(_deviceId).c_str(), defaultQos);
                 _mqttClient.subscribe(getPaymentPending(_deviceId).c_str(), defaultQos);
@@ -517,22 +1911,47 @@ bool FirmnginKit::connectServer() {
                 _mqttClient.subscribe(getPmOnExpired(_deviceId).c_str(), defaultQos);
                 _mqttClient.subscribe(getPmOnSuccess(_deviceId).c_str(), defaultQos);
                 _mqttClient.subscribe(getDownstreamTopic(_deviceId).c_str(), defaultQos);
+                _mqttClient.subscribe(getBulkTopic(_deviceId).c_str(), defaultQos);
+                _mqttClient.subscribe(getRulesTopic(_deviceId).c_str(), defaultQos);
+                if (_streamingClient) {
+                    const std::map<String, StreamCallbackFunction>& streams = _streamingClient->callbacks();
+                    for (std::map<String, StreamCallbackFunction>::const_iterator stream = streams.begin(); stream != streams.end(); ++stream) {
+                        _mqttClient.subscribe(stream->first.c_str(), defaultQos);
+                    }
+                }
+                if (_sequenceWindow) {
+                    _mqttClient.subscribe(getRetransmitTopic(_deviceId).c_str(), defaultQos);
+                }
+                if (_shadow) {
+                    _mqttClient.subscribe(getStateRequestTopic(_deviceId).c_str(), defaultQos);
+                }
+                if (_endpointCount > 1) {
+                    _mqttClient.subscribe(getEchoTopic(_deviceId).c_str(), 0);
+                }
 
                 _mqttClient.publish(willTopic.c_str(), "", true);
                 delay(10);
                 
                 _mqttClient.publish(willTopic.c_str(), "1", true);
-                if (_debug) {
+                if (_tlsReadyMillis == 0) {
+                    _tlsReadyMillis = millis() - _beginMillis;
+                }
+                if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
                     Serial.println("Connected to firmngin.dev");
+                    Serial.print("Ready ");
+                    Serial.print(_tlsReadyMillis);
+                    Serial.println(" ms after begin()");
+                }
+                if (_shadow && _shadow->dirtyCount() > 0) {
+                    publishShadow(false);
                 }
-                Serial.println("Ready...");
                 return true;
             } else {
                 int mqttState = _mqttClient.state();
-                Serial.print("Connection failed, rc=");
-                Serial.print(mqttState);
-
-                if (_debug) {
+                FNGIN_EVENT(FNGIN_LOG_ERROR, LOG_MQTT_FAILED, mqttState, retryCount + 1);
+                if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                    Serial.print("Connection failed, rc=");
+                    Serial.print(mqttState);
                     Serial.print(" (");
                     switch(mqttState) {
                         case -4: Serial.print("MQTT_CONNECTION_TIMEOUT"); break;
@@ -549,16 +1968,28 @@ bool FirmnginKit::connectServer() {
                         case 5: Serial.print("MQTT_CONNECT_UNAUTHORIZED"); break;
                         default: Serial.print("UNKNOWN"); break;
                     }
-                    Serial.print(")");
+                    Serial.println(")");
                 }
-                Serial.println();
                 retryCount++;
+
+                // Fail over right away instead of retrying the same broker
+                if (_activeEndpoint >= 0) {
+                    BrokerEndpoint& failed = _endpoints[_activeEndpoint];
+                    if (failed.failures < 255) failed.failures++;
+                    int next = bestEndpoint();
+                    if (next != _activeEndpoint) {
+                        selectEndpoint(next);
+                        _lastMQTTAttempt = millis() - _delayRetryMQTT;
+                    }
+                }
             }
         }
     }
 
-    if (!_mqttClient.connected()) {
-        Serial.println("Connection failed, restarting...");
+    if (!_mqttClient.connected() && _endpointCount < 2) {
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("Connection failed, restarting...");
+        }
         delay(1000);
         ESP.restart();
     }
@@ -567,6 +1998,37 @@ bool FirmnginKit::connectServer() {
 }
 
 void FirmnginKit::mqttCallback(char *topic, byte *payload, unsigned int length) {
+    FNGIN_EVENT(FNGIN_LOG_DEBUG, LOG_MESSAGE, length, 0);
+    // Bulk frames are copied only when they reach user code
+    if (isDeviceTopic(topic, "/rb")) {
+        handleBulkCommand((const char*)payload, length);
+        return;
+    }
+    if (_endpointCount > 1 && isDeviceTopic(topic, "/echo")) {
+        handleEcho(payload, length);
+        return;
+    }
+    if (_shadow && isDeviceTopic(topic, "/sr")) {
+        publishShadow(true);
+        return;
+    }
+    if (isDeviceTopic(topic, "/rules")) {
+        bool compiled = loadRules((const char*)payload, length);
+        ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(2));
+        doc["rules"] = getRuleCount();
+        doc["ok"] = compiled;
+        publishJson(getRuleFiringTopic(_deviceId), doc);
+        return;
+    }
+
+    // Stamp arrival before anything else when tracing
+    uint64_t arrivalMs = 0;
+    unsigned long arrivalUs = 0;
+    if (_latencyTracer) {
+        arrivalMs = epochMillis();
+        arrivalUs = micros();
+    }
+
     String payloadStr;
     payloadStr.reserve(length);
     for (unsigned int i = 0; i < length; i++) {
@@ -574,6 +2036,45 @@ void FirmnginKit::mqttCallback(char *topic, byte *payload, unsigned int length)
     }
 
     String topicStr = String(topic);
+
+    if (!_latencyTracer) {
+        dispatchMessage(topicStr, payloadStr);
+        return;
+    }
+
+    // Server timestamp (epoch ms): "ts" field of JSON payloads,
+    // ";ts=<ms>" suffix on /rs/ payloads (stripped before dispatch)
+    TraceRoute route = TRACE_OTHER;
+    uint64_t serverMs = 0;
+    String vpinPrefix = String("/d/") + String(_deviceId) + "/rs/";
+    if (topicStr.startsWith(vpinPrefix)) {
+        route = TRACE_VPIN;
+        int suffix = payloadStr.lastIndexOf(";ts=");
+        if (suffix >= 0) {
+            serverMs = strtoull(payloadStr.c_str() + suffix + 4, nullptr, 10);
+            payloadStr.remove(suffix);
+        }
+    } else {
+        String stateType = topicStr.substring(topicStr.lastIndexOf('/') + 1);
+        if (stateType == T_PAYMENT_SUCCESS) route = TRACE_PAYMENT;
+        else if (stateType == T_PM_ON_SUCCESS) route = TRACE_PAYMENT_SUCCESS;
+        int field = payloadStr.indexOf("\"ts\":");
+        if (field >= 0) {
+            serverMs = strtoull(payloadStr.c_str() + field + 5, nullptr, 10);
+        }
+    }
+
+    dispatchMessage(topicStr, payloadStr);
+
+    if (serverMs > 0 && arrivalMs > 0) {
+        uint32_t handlerUs = micros() - arrivalUs;
+        int64_t networkMs = (int64_t)(arrivalMs - serverMs);
+        _latencyTracer->observe(networkMs);
+        _latencyTracer->record(route, networkMs + handlerUs / 1000, handlerUs);
+    }
+}
+
+void FirmnginKit::dispatchMessage(const String& topicStr, const String& payloadStr) {
     String expectedPrefix = String("/d/") + String(_deviceId) + "/rs/";
     
     // Check if topic matches pattern: /d/{deviceId}/rs/{vpin}
@@ -583,20 +2084,19 @@ void FirmnginKit::mqttCallback(char *topic, byte *payload, unsigned int length)
         int vpinId = vpinStr.toInt();
         
         if (vpinId > 0) {
-            if (_virtualPinCallbacks.count(vpinId) > 0) {
-                // Payload is directly a string, pass it to handler
-                _virtualPinCallbacks[vpinId](payloadStr);
-            } else if (_debug) {
-                Serial.print("No handler registered for virtual pin: ");
-                Serial.println(vpinId);
-            }
-        } else if (_debug) {
+            dispatchVirtualPin(vpinId, payloadStr);
+        } else if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
             Serial.print("Invalid virtual pin ID in topic: ");
             Serial.println(topicStr);
         }
         return;
     }
 
+    if (_sequenceWindow && topicStr == getRetransmitTopic(_deviceId)) {
+        handleRetransmitRequest(payloadStr);
+        return;
+    }
+
     String stateType = "";
     
     int lastSlash = topicStr.lastIndexOf('/');
@@ -615,20 +2115,1423 @@ void FirmnginKit::mqttCallback(char *topic, byte *payload, unsigned int length)
     }
 }
 
-FirmnginKit &FirmnginKit::endSession() {
-    String topic = "fngin/";
-    topic += _deviceId;
+// Same path for /d/{id}/rs/{vpin} and LAN commands
+void FirmnginKit::dispatchVirtualPin(int vpinId, const String& payload) {
+    if (_virtualPinCallbacks.count(vpinId) > 0) {
+        // Payload is directly a string, pass it to handler
+        _virtualPinCallbacks[vpinId](payload);
+    } else {
+        FNGIN_EVENT(FNGIN_LOG_WARN, LOG_VPIN_UNHANDLED, vpinId, 0);
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.print("No handler registered for virtual pin: ");
+            Serial.println(vpinId);
+        }
+    }
+    if (_edgeRules) {
+        bool on = vpinStateOn(payload.c_str(), payload.length());
+        evaluateRules(vpinId, on ? 1.0f : payload.toFloat());
+    }
+}
 
-    if (_mqttClient.connected()) {
-#if ARDUINOJSON_VERSION_MAJOR >= 7
-        JsonDocument doc;
+static bool gpioGroupable(int gpio) {
+#if defined(ESP8266)
+    return gpio >= 0 && gpio <= 16;
+#elif defined(FNGIN_GPIO_REGISTERS) && !defined(GPIO_OUT1_W1TS_REG)
+    return gpio >= 0 && gpio < 32;
 #else
-        DynamicJsonDocument doc(256);
+    return gpio >= 0 && gpio < 64;
 #endif
-        doc["state"] = "end_session";
-        String payload;
-        serializeJson(doc, payload);
-        _mqttClient.publish(topic.c_str(), payload.c_str());
+}
+
+// Sets first, then clears: every pin in the masks switches within two register writes
+static void writeOutputMasks(uint64_t setMask, uint64_t clearMask) {
+#if defined(ESP8266)
+    if (setMask & 0xFFFF) GPOS = (uint32_t)(setMask & 0xFFFF);
+    if (clearMask & 0xFFFF) GPOC = (uint32_t)(clearMask & 0xFFFF);
+    // GPIO16 is in the RTC block, not in GPOS/GPOC
+    if (setMask & (1UL << 16)) digitalWrite(16, HIGH);
+    if (clearMask & (1UL << 16)) digitalWrite(16, LOW);
+#elif defined(FNGIN_GPIO_REGISTERS)
+    if ((uint32_t)setMask) REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)setMask);
+    if ((uint32_t)clearMask) REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clearMask);
+#if defined(GPIO_OUT1_W1TS_REG)
+    if (setMask >> 32) REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(setMask >> 32));
+    if (clearMask >> 32) REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clearMask >> 32));
+#endif
+#else
+    for (uint8_t gpio = 0; gpio < 64; gpio++) {
+        if (setMask & (1ULL << gpio)) digitalWrite(gpio, HIGH);
+        else if (clearMask & (1ULL << gpio)) digitalWrite(gpio, LOW);
     }
-    return *this;
+#endif
+}
+
+// Hardware RNG, valid while the radio is on
+static uint32_t hardwareRandom() {
+#if defined(ESP8266)
+    return ESP.random();
+#elif defined(ESP32)
+    return esp_random();
+#else
+    return (uint32_t)random(0x7FFFFFFF);
+#endif
+}
+
+// LAN control: UDP datagrams "seq|commands|hmac" from phones on the same
+// network, replied to with "seq|ok|handlerUs|hmac".
+//   commands  "vpin=value" pairs as in bulk frames, "5=ON;7=128"
+//   hmac      hex HMAC-SHA256(deviceKey, deviceId "|" nonce "|" everything before the last '|')
+// The nonce is drawn at every boot and fetched with "hello|hmac" (signed
+// without it), answered by "hello|nonce|hmac". Packets signed before a
+// reboot therefore fail verification, and seq only has to increase within
+// one boot. Epoch ms seq is still checked against LOCAL_CONTROL_MAX_SKEW_MS.
+bool FirmnginKit::enableLocalControl(uint16_t port) {
+    if (_localUdp) return true;
+    snprintf(_localNonce, sizeof(_localNonce), "%08lx", (unsigned long)hardwareRandom());
+    _localUdp = new WiFiUDP();
+    if (!_localUdp->begin(port)) {
+        delete _localUdp;
+        _localUdp = nullptr;
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+            Serial.println("Local control: UDP port not available");
+        }
+        return false;
+    }
+    if (FNGIN_SERIAL_LOG(FNGIN_LOG_INFO)) {
+        Serial.print("Local control on UDP port ");
+        Serial.println(port);
+    }
+    return true;
+}
+
+// A few datagrams per loop(), the rest stay in the socket buffer
+void FirmnginKit::pollLocalControl() {
+    for (uint8_t i = 0; i < 4; i++) {
+        int size = _localUdp->parsePacket();
+        if (size <= 0) return;
+        if (size > LOCAL_CONTROL_MAX_PACKET) {
+            _localStats.rejected++;
+            continue;
+        }
+        char packet[LOCAL_CONTROL_MAX_PACKET + 1];
+        int length = _localUdp->read((uint8_t*)packet, size);
+        if (length <= 0) continue;
+        packet[length] = '\0';
+        handleLocalPacket(packet, length);
+    }
+}
+
+void hmacSha256(const uint8_t* key, size_t keyLength, const char* const* parts, const size_t* lengths, size_t count, uint8_t* mac) {
+#if defined(ESP8266)
+    br_hmac_key_context keyContext;
+    br_hmac_context context;
+    br_hmac_key_init(&keyContext, &br_sha256_vtable, key, keyLength);
+    br_hmac_init(&context, &keyContext, 0);
+    for (size_t i = 0; i < count; i++) {
+        br_hmac_update(&context, parts[i], lengths[i]);
+    }
+    br_hmac_out(&context, mac);
+#elif defined(ESP32)
+    mbedtls_md_context_t context;
+    mbedtls_md_init(&context);
+    mbedtls_md_setup(&context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&context, key, keyLength);
+    for (size_t i = 0; i < count; i++) {
+        mbedtls_md_hmac_update(&context, (const unsigned char*)parts[i], lengths[i]);
+    }
+    mbedtls_md_hmac_finish(&context, mac);
+    mbedtls_md_free(&context);
+#else
+    memset(mac, 0, 32);
+#endif
+}
+
+// "{deviceId}|{nonce}|{message}". The hello exchange that hands out the
+// nonce is signed without it.
+void FirmnginKit::signLocal(const char* message, size_t length, uint8_t* mac, bool withNonce) {
+    const char* parts[] = { _deviceId, "|", _localNonce, "|", message };
+    size_t lengths[] = { strlen(_deviceId), 1, strlen(_localNonce), 1, length };
+    if (!withNonce) {
+        parts[2] = message;
+        lengths[2] = length;
+    }
+    hmacSha256((const uint8_t*)_deviceKey, strlen(_deviceKey), parts, lengths, withNonce ? 5 : 3, mac);
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Next "vpin=value" pair of a bulk frame or LAN command list, pairs without
+// a valid VPin are skipped
+static bool nextBulkPair(const char* payload, size_t length, size_t& pos, int& vpin, const char*& value, size_t& valueLength) {
+    while (pos < length) {
+        const char* pair = payload + pos;
+        size_t pairLength = 0;
+        while (pos + pairLength < length && pair[pairLength] != ';' && pair[pairLength] != ',') {
+            pairLength++;
+        }
+        pos += pairLength + 1;
+
+        const char* separator = (const char*)memchr(pair, '=', pairLength);
+        if (!separator) continue;
+        vpin = (int)vpinParseInt(pair, separator - pair);
+        value = separator + 1;
+        valueLength = pair + pairLength - value;
+        if (vpin > 0) return true;
+    }
+    return false;
+}
+
+// Rejected, stale and replayed datagrams get no reply, so the device
+// cannot be used to reflect traffic and does not confirm guesses
+void FirmnginKit::handleLocalPacket(char* packet, size_t length) {
+    unsigned long start = micros();
+    char* commands = strchr(packet, '|');
+    char* signature = strrchr(packet, '|');
+    if (!commands || packet + length - signature != 65) {
+        _localStats.rejected++;
+        return;
+    }
+    bool hello = commands == signature && signature - packet == 5 && memcmp(packet, "hello", 5) == 0;
+    if (!hello && commands == signature) {
+        _localStats.rejected++;
+        return;
+    }
+
+    // Compare every byte, so the time taken does not tell how much matched
+    uint8_t expected[32];
+    signLocal(packet, signature - packet, expected, !hello);
+    uint8_t difference = 0;
+    for (uint8_t i = 0; i < 32; i++) {
+        int high = hexDigit(signature[1 + 2 * i]);
+        int low = hexDigit(signature[2 + 2 * i]);
+        if (high < 0 || low < 0) difference = 1;
+        difference |= expected[i] ^ (uint8_t)((high << 4) | low);
+    }
+    if (difference) {
+        _localStats.rejected++;
+        FNGIN_EVENT(FNGIN_LOG_WARN, LOG_LOCAL_REJECTED, 1, 0);
+        if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+            Serial.println("Local control: bad signature");
+        }
+        return;
+    }
+
+    if (hello) {
+        char reply[96];
+        int replyLength = snprintf(reply, sizeof(reply), "hello|%s", _localNonce);
+        sendLocal(reply, replyLength, false);
+        return;
+    }
+
+    *commands++ = '\0';
+    *signature = '\0';
+    uint64_t seq = strtoull(packet, nullptr, 10);
+    uint64_t now = epochMillis();
+    bool fresh = seq > _localSequence;
+    if (fresh && now > 0 && seq > 1577836800000ULL) {
+        uint64_t skew = seq > now ? seq - now : now - seq;
+        fresh = skew <= LOCAL_CONTROL_MAX_SKEW_MS;
+    }
+    if (!fresh) {
+        _localStats.stale++;
+        FNGIN_EVENT(FNGIN_LOG_WARN, LOG_LOCAL_REJECTED, 2, 0);
+        return;
+    }
+    _localSequence = seq;
+
+    size_t pos = 0;
+    int vpin;
+    const char* text;
+    size_t textLength;
+    while (nextBulkPair(commands, signature - commands, pos, vpin, text, textLength)) {
+        String value;
+        value.reserve(textLength);
+        for (size_t i = 0; i < textLength; i++) {
+            value += text[i];
+        }
+        dispatchVirtualPin(vpin, value);
+        _localPending[vpin] = value;
+    }
+
+    uint32_t handlerUs = micros() - start;
+    _localStats.commands++;
+    _localStats.lastHandlerUs = handlerUs;
+    if (handlerUs > _localStats.maxHandlerUs) _localStats.maxHandlerUs = handlerUs;
+    FNGIN_EVENT(FNGIN_LOG_DEBUG, LOG_LOCAL_COMMAND, handlerUs, 0);
+    replyLocal(packet, "ok", handlerUs);
+}
+
+void FirmnginKit::replyLocal(const char* seq, const char* status, uint32_t handlerUs) {
+    char reply[128];
+    int length = snprintf(reply, sizeof(reply), "%.24s|%s|%lu", seq, status, (unsigned long)handlerUs);
+    sendLocal(reply, length, true);
+}
+
+// Appends "|hmac" to the message (room for 65 more bytes) and sends it back
+void FirmnginKit::sendLocal(char* reply, int length, bool withNonce) {
+    uint8_t mac[32];
+    signLocal(reply, length, mac, withNonce);
+    static const char digits[] = "0123456789abcdef";
+    reply[length++] = '|';
+    for (uint8_t i = 0; i < 32; i++) {
+        reply[length++] = digits[mac[i] >> 4];
+        reply[length++] = digits[mac[i] & 0x0F];
+    }
+
+    _localUdp->beginPacket(_localUdp->remoteIP(), _localUdp->remotePort());
+    _localUdp->write((const uint8_t*)reply, length);
+    _localUdp->endPacket();
+}
+
+// LAN commands and rule actions are reported like a pushState once the
+// broker is reachable, only the latest value per VPin
+void FirmnginKit::publishLocalState() {
+    if (_localPending.empty()) return;
+    for (std::map<int, String>::iterator entry = _localPending.begin(); entry != _localPending.end(); ++entry) {
+        pushState(entry->first, entry->second);
+    }
+    _localPending.clear();
+}
+
+// Rule input for a command value, like dispatchVirtualPin: ON words are 1
+static float bulkRuleValue(const char* value, size_t length) {
+    if (vpinStateOn(value, length)) return 1.0f;
+    char number[16];
+    if (length >= sizeof(number)) length = sizeof(number) - 1;
+    memcpy(number, value, length);
+    number[length] = '\0';
+    return (float)atof(number);
+}
+
+// Bulk command frame on /d/{id}/rb: "vpin=value" pairs separated by ';' or ','
+//   "1=ON;2=off;3=1;10=128"
+// Bound VPins are applied directly, other VPins go to their onVirtualPin
+// callback. Edge rules see the values once the whole frame is applied.
+// Frames for bound VPins only are parsed in place. A frame that reaches
+// callbacks or rules is copied first: a publish from user code reuses the
+// MQTT buffer the frame is in.
+void FirmnginKit::handleBulkCommand(const char* payload, size_t length) {
+    uint64_t setMask = 0;
+    uint64_t clearMask = 0;
+    size_t pos = 0;
+    int vpin;
+    const char* value;
+    size_t valueLength;
+
+    bool reachesUserCode = _edgeRules && _edgeRules->count() > 0;
+    while (!reachesUserCode && nextBulkPair(payload, length, pos, vpin, value, valueLength)) {
+        reachesUserCode = _boundPins.find(vpin) == _boundPins.end();
+    }
+    char stackCopy[BULK_COPY_STACK];
+    char* heapCopy = nullptr;
+    if (reachesUserCode) {
+        char* copy = length <= sizeof(stackCopy) ? stackCopy : (heapCopy = (char*)malloc(length));
+        if (!copy) {
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_ERROR)) {
+                Serial.println("Bulk command dropped: out of memory");
+            }
+            return;
+        }
+        memcpy(copy, payload, length);
+        payload = copy;
+    }
+    pos = 0;
+
+    while (nextBulkPair(payload, length, pos, vpin, value, valueLength)) {
+        std::map<int, VPinBase*>::iterator bound = _boundPins.find(vpin);
+        if (bound != _boundPins.end()) {
+            VPinBase* pin = bound->second;
+            bool level;
+            if (_groupedWrite && pin->levelFor(value, valueLength, level) && gpioGroupable(pin->getGpio())) {
+                uint64_t bit = 1ULL << pin->getGpio();
+                if (level) {
+                    setMask |= bit;
+                    clearMask &= ~bit;
+                } else {
+                    clearMask |= bit;
+                    setMask &= ~bit;
+                }
+            } else {
+                pin->handle(value, valueLength);
+            }
+            continue;
+        }
+
+        std::map<int, VirtualPinCallbackFunction>::iterator callback = _virtualPinCallbacks.find(vpin);
+        if (callback != _virtualPinCallbacks.end()) {
+            String valueStr;
+            valueStr.reserve(valueLength);
+            for (size_t i = 0; i < valueLength; i++) {
+                valueStr += value[i];
+            }
+            callback->second(valueStr);
+        } else {
+            FNGIN_EVENT(FNGIN_LOG_WARN, LOG_VPIN_UNHANDLED, vpin, 0);
+            if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) {
+                Serial.print("No handler registered for virtual pin: ");
+                Serial.println(vpin);
+            }
+        }
+    }
+
+    if (setMask || clearMask) {
+        writeOutputMasks(setMask, clearMask);
+    }
+
+    if (_edgeRules && _edgeRules->count() > 0) {
+        pos = 0;
+        while (nextBulkPair(payload, length, pos, vpin, value, valueLength)) {
+            evaluateRules(vpin, bulkRuleValue(value, valueLength));
+        }
+    }
+    free(heapCopy);
+}
+
+FirmnginKit &FirmnginKit::endSession() {
+    String topic = "fngin/";
+    topic += _deviceId;
+
+    if (_mqttClient.connected()) {
+        ArenaJsonDocument doc(&_arena, JSON_OBJECT_SIZE(1));
+        doc["state"] = "end_session";
+        publishJson(topic, doc, SEQ_NONE, LANE_CONTROL);
+    }
+    return *this;
+}
+
+// LEB128: 7 bits per byte, low group first, high bit set on all but the last
+uint8_t* TimeSeries::writeVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+// 0, -1, 1, -2 ... -> 0, 1, 2, 3 ..., so small negative deltas stay short
+uint64_t TimeSeries::zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+TimeSeries::TimeSeries(int vpin, size_t blockBytes, uint8_t decimals)
+    : _vpin(vpin),
+      _blockBytes(blockBytes > HEADER_SIZE + 2 * MAX_SAMPLE_SIZE ? blockBytes : HEADER_SIZE + 2 * MAX_SAMPLE_SIZE),
+      _decimals(decimals),
+      _scale(1)
+{
+    for (uint8_t i = 0; i < decimals; i++) _scale *= 10;
+    _storage = (uint8_t*)malloc(_blockBytes * 2);
+    for (uint8_t i = 0; i < 2; i++) {
+        _blocks[i].data = _storage ? _storage + i * _blockBytes : nullptr;
+        _blocks[i].length = 0;
+        _blocks[i].count = 0;
+        _blocks[i].sealed = false;
+    }
+}
+
+TimeSeries::~TimeSeries() {
+    free(_storage);
+}
+
+void TimeSeries::startBlock(Block& block, int32_t value, uint32_t timestampMicros) {
+    // Epoch of this sample: wall clock now minus how long ago it was taken
+    uint64_t now = FirmnginKit::epochMicros();
+    uint64_t t0 = now ? now - (uint32_t)(micros() - timestampMicros) : 0;
+
+    uint8_t* out = block.data;
+    *out++ = 1;
+    *out++ = _vpin & 0xFF;
+    *out++ = (_vpin >> 8) & 0xFF;
+    *out++ = _decimals;
+    out += 2;   // count, written by seal()
+    for (uint8_t i = 0; i < 8; i++) {
+        *out++ = (t0 >> (8 * i)) & 0xFF;
+    }
+    out = writeVarint(out, zigzag(value));
+
+    block.length = out - block.data;
+    block.count = 1;
+    block.lastMicros = timestampMicros;
+    block.lastDelta = 0;
+    block.lastValue = value;
+}
+
+void TimeSeries::seal(Block& block) {
+    block.data[4] = block.count & 0xFF;
+    block.data[5] = (block.count >> 8) & 0xFF;
+    block.sealed = true;
+    block.sealOrder = _sealCounter++;
+    _active ^= 1;
+}
+
+bool TimeSeries::record(int32_t value, uint32_t timestampMicros) {
+    if (!_storage) return false;
+
+    Block* block = &_blocks[_active];
+    // Once both blocks are full the active one is already sealed, sealing
+    // it again would move it behind the other one in send order
+    if (!block->sealed && block->count > 0 &&
+        (block->length + MAX_SAMPLE_SIZE > _blockBytes || block->count == 0xFFFF)) {
+        seal(*block);
+        block = &_blocks[_active];
+    }
+    if (block->sealed) {
+        _dropped++;
+        return false;
+    }
+
+    _samples++;
+    if (block->count == 0) {
+        startBlock(*block, value, timestampMicros);
+        return true;
+    }
+
+    int32_t delta = timestampMicros - block->lastMicros;
+    uint8_t* out = block->data + block->length;
+    out = writeVarint(out, zigzag((int64_t)delta - block->lastDelta));
+    out = writeVarint(out, zigzag((int64_t)value - block->lastValue));
+
+    block->length = out - block->data;
+    block->count++;
+    block->lastMicros = timestampMicros;
+    block->lastDelta = delta;
+    block->lastValue = value;
+    return true;
+}
+
+bool TimeSeries::record(float value) {
+    return record((int32_t)lroundf(value * _scale));
+}
+
+// Seal the open block so the next send() ships it
+void TimeSeries::flush() {
+    Block& block = _blocks[_active];
+    if (block.count > 0 && !block.sealed) {
+        seal(block);
+    }
+}
+
+TimeSeries::Block* TimeSeries::oldestSealed() {
+    Block* oldest = nullptr;
+    for (uint8_t i = 0; i < 2; i++) {
+        if (_blocks[i].sealed && (!oldest || _blocks[i].sealOrder < oldest->sealOrder)) {
+            oldest = &_blocks[i];
+        }
+    }
+    return oldest;
+}
+
+// The block send() publishes next, nullptr if none is sealed
+const uint8_t* TimeSeries::nextBlock(size_t& length) {
+    Block* oldest = oldestSealed();
+    length = oldest ? oldest->length : 0;
+    return oldest ? oldest->data : nullptr;
+}
+
+// Publish sealed blocks oldest first, returns how many were sent
+int TimeSeries::send() {
+    if (!_globalFirmnginKitInstance) return 0;
+
+    int sent = 0;
+    for (uint8_t n = 0; n < 2; n++) {
+        Block* oldest = oldestSealed();
+        if (!oldest || !_globalFirmnginKitInstance->publishTimeSeries(oldest->data, oldest->length)) {
+            break;
+        }
+        oldest->sealed = false;
+        oldest->count = 0;
+        oldest->length = 0;
+        sent++;
+    }
+    return sent;
+}
+
+static const char* TRACE_ROUTE_NAMES[TRACE_ROUTE_COUNT] = { "pm", "mos", "rs", "other" };
+
+// Buckets: 0..3 exact, then 4 per power of two
+uint8_t LatencyHistogram::bucketOf(uint32_t value) {
+    if (value < 4) return value;
+    uint8_t octave = 31 - __builtin_clz(value);
+    uint8_t index = 4 + (octave - 2) * 4 + ((value >> (octave - 2)) & 3);
+    return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+uint32_t LatencyHistogram::bucketStart(uint8_t index) {
+    if (index < 4) return index;
+    uint8_t octave = (index - 4) / 4 + 2;
+    return (uint32_t)(4 + (index - 4) % 4) << (octave - 2);
+}
+
+void LatencyHistogram::add(uint32_t value) {
+    uint8_t index = bucketOf(value);
+    if (_buckets[index] == 0xFFFF) {
+        _count = 0;
+        for (uint8_t i = 0; i < BUCKETS; i++) {
+            _buckets[i] >>= 1;
+            _count += _buckets[i];
+        }
+    }
+    _buckets[index]++;
+    _count++;
+    if (value > _max) _max = value;
+}
+
+// Upper bound of the bucket holding the pct-th percentile
+uint32_t LatencyHistogram::percentile(uint8_t pct) const {
+    if (_count == 0) return 0;
+    uint32_t target = ((uint64_t)_count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        seen += _buckets[i];
+        if (seen >= target) {
+            uint32_t upper = i + 1 < BUCKETS ? bucketStart(i + 1) - 1 : _max;
+            return upper < _max ? upper : _max;
+        }
+    }
+    return _max;
+}
+
+// Smallest (arrival - server timestamp) over the last two windows. The
+// network delay is never negative, so a negative minimum means the device
+// clock is behind the server by at least that much.
+void LatencyTracer::observe(int64_t arrivalMinusServerMs) {
+    if (arrivalMinusServerMs < _minDelta) _minDelta = arrivalMinusServerMs;
+    if (++_offsetSamples >= OFFSET_WINDOW) {
+        _previousMinDelta = _minDelta;
+        _minDelta = INT32_MAX;
+        _offsetSamples = 0;
+    }
+}
+
+int32_t LatencyTracer::clockOffset() const {
+    int64_t minDelta = _minDelta < _previousMinDelta ? _minDelta : _previousMinDelta;
+    return minDelta < 0 ? (int32_t)minDelta : 0;
+}
+
+void LatencyTracer::record(TraceRoute route, int64_t endToEndMs, uint32_t handlerUs) {
+    int64_t corrected = endToEndMs - clockOffset();
+    _endToEnd[route].add(corrected > 0 ? (uint32_t)corrected : 0);
+    _handler[route].add(handlerUs);
+}
+
+LatencyStats LatencyTracer::stats(TraceRoute route) const {
+    LatencyStats stats;
+    stats.count = _endToEnd[route].count();
+    stats.p50Ms = _endToEnd[route].percentile(50);
+    stats.p99Ms = _endToEnd[route].percentile(99);
+    stats.maxMs = _endToEnd[route].maximum();
+    stats.handlerP50Us = _handler[route].percentile(50);
+    stats.handlerP99Us = _handler[route].percentile(99);
+    return stats;
+}
+
+void LatencyTracer::exportJson(JsonDocument& doc) const {
+    doc["offset"] = clockOffset();
+    JsonObject routes = doc["routes"].to<JsonObject>();
+    for (uint8_t i = 0; i < TRACE_ROUTE_COUNT; i++) {
+        if (_endToEnd[i].count() == 0) continue;
+        LatencyStats s = stats((TraceRoute)i);
+        JsonObject route = routes[TRACE_ROUTE_NAMES[i]].to<JsonObject>();
+        route["n"] = s.count;
+        route["p50"] = s.p50Ms;
+        route["p99"] = s.p99Ms;
+        route["max"] = s.maxMs;
+        route["h50"] = s.handlerP50Us;
+        route["h99"] = s.handlerP99Us;
+    }
+}
+
+void TokenBucket::configure(uint32_t milliRate, uint32_t milliCapacity) {
+    _rate = milliRate;
+    _capacity = milliCapacity;
+    _tokens = milliCapacity;
+    _carry = 0;
+}
+
+void TokenBucket::refill(unsigned long elapsedMs) {
+    if (_rate == 0) return;
+    // _rate is thousandths per second, so elapsedMs * _rate is millionths
+    uint64_t scaled = (uint64_t)elapsedMs * _rate + _carry;
+    uint64_t tokens = (uint64_t)_tokens + scaled / 1000;
+    if (tokens >= _capacity) {
+        _tokens = _capacity;
+        _carry = 0;
+    } else {
+        _tokens = (uint32_t)tokens;
+        _carry = scaled % 1000;
+    }
+}
+
+// A message bigger than the burst is let through once the bucket is full
+bool TokenBucket::allows(uint32_t units) const {
+    if (_rate == 0) return true;
+    uint64_t needed = (uint64_t)units * 1000;
+    return _tokens >= min(needed, (uint64_t)_capacity);
+}
+
+void TokenBucket::take(uint32_t units) {
+    if (_rate == 0) return;
+    uint64_t cost = (uint64_t)units * 1000;
+    _tokens = cost >= _tokens ? 0 : _tokens - cost;
+}
+
+OutboundScheduler::OutboundScheduler(uint8_t depth, Sender sender)
+    : _depth(depth ? depth : 1),
+      _sender(sender),
+      _lastRefill(millis())
+{
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        _lanes[i].queue = new Message[_depth];
+    }
+}
+
+OutboundScheduler::~OutboundScheduler() {
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        Lane& lane = _lanes[i];
+        for (uint8_t n = 0; n < lane.count; n++) {
+            free(lane.queue[(lane.head + n) % _depth].data);
+        }
+        delete[] lane.queue;
+    }
+}
+
+// Burst is one second worth of tokens (at least one message). Rates beyond
+// the uint32_t thousandths range are clamped, they are unlimited in practice.
+void OutboundScheduler::setRate(OutboundLane lane, float messagesPerSec, uint32_t bytesPerSec) {
+    uint32_t milliMessages = 0;
+    if (messagesPerSec > 0) {
+        milliMessages = messagesPerSec < UINT32_MAX / 1000 ? (uint32_t)(messagesPerSec * 1000) : UINT32_MAX;
+        if (milliMessages == 0) milliMessages = 1;
+    }
+    uint32_t milliBytes = bytesPerSec < UINT32_MAX / 1000 ? bytesPerSec * 1000 : UINT32_MAX;
+    _lanes[lane].messages.configure(milliMessages, max(milliMessages, (uint32_t)1000));
+    _lanes[lane].bytes.configure(milliBytes, milliBytes);
+}
+
+void OutboundScheduler::refill() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - _lastRefill;
+    if (elapsed == 0) return;
+    _lastRefill = now;
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        _lanes[i].messages.refill(elapsed);
+        _lanes[i].bytes.refill(elapsed);
+    }
+}
+
+bool OutboundScheduler::ready(Lane& lane, size_t length) const {
+    return lane.messages.allows(1) && lane.bytes.allows(length);
+}
+
+bool OutboundScheduler::send(Lane& lane, const char* topic, const uint8_t* payload, size_t length, bool retained) {
+    if (!_sender(topic, payload, length, retained)) return false;
+    lane.messages.take(1);
+    lane.bytes.take(length);
+    lane.sent++;
+    return true;
+}
+
+SubmitResult OutboundScheduler::submit(OutboundLane laneId, const char* topic, const uint8_t* payload, size_t length, bool retained) {
+    refill();
+    Lane& lane = _lanes[laneId];
+
+    bool higherQueued = _held && laneId != LANE_CONTROL;
+    for (uint8_t i = 0; i <= laneId; i++) {
+        if (_lanes[i].count > 0) higherQueued = true;
+    }
+    uint8_t attempts = 0;
+    if (!higherQueued && ready(lane, length)) {
+        if (send(lane, topic, payload, length, retained)) return SUBMIT_SENT;
+        attempts = 1;
+    }
+
+    if (lane.count >= _depth) {
+        lane.dropped++;
+        return SUBMIT_DROPPED;
+    }
+
+    size_t topicLength = strlen(topic) + 1;
+    uint8_t* data = (uint8_t*)malloc(topicLength + length);
+    if (!data) {
+        lane.dropped++;
+        return SUBMIT_DROPPED;
+    }
+    memcpy(data, topic, topicLength);
+    memcpy(data + topicLength, payload, length);
+
+    Message& message = lane.queue[(lane.head + lane.count) % _depth];
+    message.data = data;
+    message.length = length;
+    message.retained = retained;
+    message.attempts = attempts;
+    message.queuedAt = millis();
+    lane.count++;
+    return SUBMIT_QUEUED;
+}
+
+void OutboundScheduler::pop(Lane& lane) {
+    free(lane.queue[lane.head].data);
+    lane.head = (lane.head + 1) % _depth;
+    lane.count--;
+}
+
+// Highest lane first; a lane out of tokens does not block the lanes below it
+void OutboundScheduler::drain() {
+    refill();
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        if (_held && i != LANE_CONTROL) break;
+        Lane& lane = _lanes[i];
+        while (lane.count > 0) {
+            Message& message = lane.queue[lane.head];
+            const char* topic = (const char*)message.data;
+            const uint8_t* payload = message.data + strlen(topic) + 1;
+            if (!ready(lane, message.length)) break;
+            if (!send(lane, topic, payload, message.length, message.retained)) {
+                // One attempt per drain() so a short outage does not use them up
+                if (++message.attempts < MAX_SEND_ATTEMPTS) break;
+                lane.failed++;
+                pop(lane);
+                continue;
+            }
+            uint32_t waited = millis() - message.queuedAt;
+            if (waited > _maxWaitMs) _maxWaitMs = waited;
+            pop(lane);
+        }
+    }
+}
+
+bool OutboundScheduler::empty() const {
+    for (uint8_t i = 0; i < LANE_COUNT; i++) {
+        if (_lanes[i].count > 0) return false;
+    }
+    return true;
+}
+
+LaneStats OutboundScheduler::stats(OutboundLane lane) const {
+    LaneStats stats;
+    stats.queued = _lanes[lane].count;
+    stats.sent = _lanes[lane].sent;
+    stats.dropped = _lanes[lane].dropped;
+    stats.failed = _lanes[lane].failed;
+    return stats;
+}
+
+// Rule value: a number, or ON/HIGH (1) and OFF/LOW (0)
+static bool parseRuleValue(const char* text, int32_t& value) {
+    if (strcasecmp(text, "ON") == 0 || strcasecmp(text, "HIGH") == 0) {
+        value = 1;
+        return true;
+    }
+    if (strcasecmp(text, "OFF") == 0 || strcasecmp(text, "LOW") == 0) {
+        value = 0;
+        return true;
+    }
+    char* end;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end) return false;
+    value = (int32_t)parsed;
+    return true;
+}
+
+// "10>=30.5:5=ON|OFF" -> source 10, op >=, threshold 30.5, target 5, value 1, release 0
+bool EdgeRules::parseRule(const char* text, size_t length, Rule& rule) {
+    char buffer[48];
+    size_t used = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == ' ' || text[i] == '\t' || text[i] == '\r') continue;
+        if (used + 1 >= sizeof(buffer)) return false;
+        buffer[used++] = text[i];
+    }
+    buffer[used] = '\0';
+
+    char* p = buffer;
+    char* end;
+    long source = strtol(p, &end, 10);
+    if (end == p || source <= 0 || source > INT16_MAX) return false;
+    p = end;
+
+    if (p[0] == '>') {
+        rule.op = p[1] == '=' ? RULE_GE : RULE_GT;
+    } else if (p[0] == '<') {
+        rule.op = p[1] == '=' ? RULE_LE : RULE_LT;
+    } else if (p[0] == '=' && p[1] == '=') {
+        rule.op = RULE_EQ;
+    } else if (p[0] == '!' && p[1] == '=') {
+        rule.op = RULE_NE;
+    } else {
+        return false;
+    }
+    p += p[1] == '=' ? 2 : 1;
+
+    double threshold = strtod(p, &end);
+    if (end == p || *end != ':') return false;
+    p = end + 1;
+
+    long target = strtol(p, &end, 10);
+    if (end == p || target <= 0 || target > INT16_MAX || *end != '=') return false;
+    p = end + 1;
+
+    char* release = strchr(p, '|');
+    if (release) *release++ = '\0';
+    if (!parseRuleValue(p, rule.value)) return false;
+    rule.hasRelease = release != nullptr;
+    if (release && !parseRuleValue(release, rule.release)) return false;
+
+    rule.source = (int16_t)source;
+    rule.target = (int16_t)target;
+    rule.threshold = (float)threshold;
+    rule.active = false;
+    return true;
+}
+
+bool EdgeRules::sameRule(const Rule& a, const Rule& b) {
+    return a.source == b.source && a.target == b.target && a.op == b.op &&
+           a.threshold == b.threshold && a.value == b.value &&
+           a.hasRelease == b.hasRelease && (!a.hasRelease || a.release == b.release);
+}
+
+// Two passes: the table is only replaced when every rule parses. A rule
+// that was already loaded keeps its state, so reloading the same table
+// does not fire it again.
+bool EdgeRules::compile(const char* text, size_t length) {
+    Rule previous[MAX_EDGE_RULES];
+    uint8_t previousCount = _count;
+    memcpy(previous, _rules, sizeof(Rule) * previousCount);
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        uint8_t count = 0;
+        size_t pos = 0;
+        while (pos < length) {
+            const char* segment = text + pos;
+            size_t segmentLength = 0;
+            while (pos + segmentLength < length && segment[segmentLength] != ';' && segment[segmentLength] != '\n') {
+                segmentLength++;
+            }
+            pos += segmentLength + 1;
+
+            bool blank = true;
+            for (size_t i = 0; i < segmentLength && blank; i++) {
+                blank = segment[i] == ' ' || segment[i] == '\t' || segment[i] == '\r';
+            }
+            if (blank) continue;
+
+            if (count >= MAX_EDGE_RULES) return false;
+            Rule rule;
+            if (!parseRule(segment, segmentLength, rule)) return false;
+            if (pass == 1) {
+                for (uint8_t i = 0; i < previousCount; i++) {
+                    if (sameRule(previous[i], rule)) {
+                        rule.active = previous[i].active;
+                        break;
+                    }
+                }
+                _rules[count] = rule;
+            }
+            count++;
+        }
+        if (pass == 1) _count = count;
+    }
+    return true;
+}
+
+void EdgeRules::evaluate(int vpin, float value, uint64_t epochMs) {
+    for (uint8_t i = 0; i < _count; i++) {
+        Rule& rule = _rules[i];
+        if (rule.source != vpin) continue;
+
+        bool holds = false;
+        switch (rule.op) {
+            case RULE_GT: holds = value > rule.threshold; break;
+            case RULE_GE: holds = value >= rule.threshold; break;
+            case RULE_LT: holds = value < rule.threshold; break;
+            case RULE_LE: holds = value <= rule.threshold; break;
+            case RULE_EQ: holds = value == rule.threshold; break;
+            case RULE_NE: holds = value != rule.threshold; break;
+        }
+        if (holds == rule.active) continue;
+
+        // State first, so an action that pushes the source VPin again does not refire
+        rule.active = holds;
+        if (holds) {
+            queueFiring(i, false, rule.value, value, epochMs);
+            _action(rule.target, rule.value);
+        } else if (rule.hasRelease) {
+            queueFiring(i, true, rule.release, value, epochMs);
+            _action(rule.target, rule.release);
+        }
+    }
+}
+
+// When the queue is full the oldest firing is dropped
+void EdgeRules::queueFiring(uint8_t index, bool released, int32_t action, float sample, uint64_t epochMs) {
+    if (_firingCount == RULE_FIRING_QUEUE) {
+        _firingHead = (_firingHead + 1) % RULE_FIRING_QUEUE;
+        _firingCount--;
+        _dropped++;
+    }
+    RuleFiring& firing = _firings[(_firingHead + _firingCount) % RULE_FIRING_QUEUE];
+    firing.rule = index;
+    firing.released = released;
+    firing.target = _rules[index].target;
+    firing.action = action;
+    firing.sample = sample;
+    firing.epochMs = epochMs;
+    _firingCount++;
+}
+
+bool EdgeRules::nextFiring(RuleFiring& firing) {
+    if (_firingCount == 0) return false;
+    firing = _firings[_firingHead];
+    _firingHead = (_firingHead + 1) % RULE_FIRING_QUEUE;
+    _firingCount--;
+    return true;
+}
+
+static const char* const LOG_EVENT_NAMES[LOG_EVENT_COUNT] = {
+    "time_sync", "mqtt_connecting", "mqtt_connected", "mqtt_failed", "mqtt_lost",
+    "endpoint_probe", "endpoint_switch", "publish_failed", "push_offline", "message",
+    "vpin_unhandled", "retransmit", "rules_loaded", "local_command", "local_rejected"
+};
+
+EventLog::EventLog(uint16_t capacity)
+    : _records(new Record[capacity ? capacity : 1]),
+      _capacity(capacity ? capacity : 1)
+{
+}
+
+EventLog::~EventLog() {
+    delete[] _records;
+}
+
+// One line per record, oldest first: "  123456 W mqtt_lost 0 1"
+void EventLog::dump(Print& out) const {
+    static const char levels[] = "-EWID";
+    if (_overwritten) {
+        out.print(_overwritten);
+        out.println(" older events overwritten");
+    }
+    for (uint16_t i = 0; i < _count; i++) {
+        const Record& entry = at(i);
+        char line[64];
+        snprintf(line, sizeof(line), "%8lu %c %s %ld %d",
+                 (unsigned long)entry.ms,
+                 entry.level <= FNGIN_LOG_DEBUG ? levels[entry.level] : '?',
+                 entry.event < LOG_EVENT_COUNT ? LOG_EVENT_NAMES[entry.event] : "unknown",
+                 (long)entry.a, (int)entry.b);
+        out.println(line);
+    }
+}
+
+StateShadow::StateShadow(uint16_t capacity)
+    : _capacity(capacity ? capacity : 1)
+{
+    _keys = new const String*[_capacity];
+    _values = new String[_capacity];
+    _dirty = new uint32_t[(_capacity + 31) / 32]();
+}
+
+StateShadow::~StateShadow() {
+    delete[] _keys;
+    delete[] _values;
+    delete[] _dirty;
+}
+
+bool StateShadow::update(const String& key, const String& value, bool delivered) {
+    std::map<String, uint16_t>::iterator entry = _slots.find(key);
+    uint16_t slot;
+    if (entry != _slots.end()) {
+        slot = entry->second;
+        if (delivered) {
+            _values[slot] = value;
+            markClean(slot);
+            return true;
+        }
+    } else {
+        if (_size >= _capacity) return false;
+        slot = _size++;
+        entry = _slots.insert(std::make_pair(key, slot)).first;
+        _keys[slot] = &entry->first;
+        if (delivered) {
+            _values[slot] = value;
+            return true;
+        }
+    }
+    // A value equal to the delivered one still goes out: the server may
+    // have seen a different value pushed offline in between
+    _values[slot] = value;
+    if (!dirty(slot)) {
+        _dirty[slot >> 5] |= (1UL << (slot & 31));
+        _dirtyCount++;
+    }
+    return true;
+}
+
+void StateShadow::markClean(uint16_t slot) {
+    if (!dirty(slot)) return;
+    _dirty[slot >> 5] &= ~(1UL << (slot & 31));
+    _dirtyCount--;
+}
+
+void StreamingClient::resetFraming() {
+    _framing = FRAME_HEADER;
+    _headerLength = 0;
+    _replayPos = 0;
+    _fixedLength = 0;
+    _remaining = 0;
+    _passRemaining = 0;
+    _stream = nullptr;
+    _acknowledge = false;
+}
+
+// Reads until the packet can be classified: the fixed header, and for a
+// PUBLISH also the topic and packet id. False while bytes are missing.
+bool StreamingClient::readHeader() {
+    while (_inner->available() > 0) {
+        int b = _inner->read();
+        if (b < 0) return false;
+        _header[_headerLength++] = (uint8_t)b;
+
+        if (_fixedLength == 0) {
+            if (_headerLength < 2 || ((_header[_headerLength - 1] & 0x80) && _headerLength < 5)) continue;
+            _fixedLength = _headerLength;
+            _remaining = 0;
+            uint32_t multiplier = 1;
+            for (size_t i = 1; i < _fixedLength; i++) {
+                _remaining += (_header[i] & 0x7F) * multiplier;
+                multiplier *= 128;
+            }
+            if ((_header[0] & 0xF0) != 0x30) return true;
+            continue;
+        }
+
+        size_t read = _headerLength - _fixedLength;
+        if (read < 2) continue;
+        size_t topicLength = ((size_t)_header[_fixedLength] << 8) | _header[_fixedLength + 1];
+        size_t needed = 2 + topicLength + (((_header[0] >> 1) & 0x03) ? 2 : 0);
+        if (topicLength > STREAM_TOPIC_MAX || needed > _remaining) return true;
+        if (read == needed) return true;
+    }
+    return false;
+}
+
+void StreamingClient::startPacket() {
+    size_t read = _headerLength - _fixedLength;
+    uint8_t qos = (_header[0] >> 1) & 0x03;
+    if ((_header[0] & 0xF0) == 0x30 && qos < 2 && read >= 2) {
+        size_t topicLength = ((size_t)_header[_fixedLength] << 8) | _header[_fixedLength + 1];
+        if (read == 2 + topicLength + (qos ? 2 : 0)) {
+            String topic;
+            topic.reserve(topicLength);
+            for (size_t i = 0; i < topicLength; i++) {
+                topic += (char)_header[_fixedLength + 2 + i];
+            }
+            std::map<String, StreamCallbackFunction>::iterator callback = _callbacks.find(topic);
+            if (callback != _callbacks.end()) {
+                _stream = &callback->second;
+                _acknowledge = qos == 1;
+                if (_acknowledge) {
+                    _packetId = ((uint16_t)_header[_headerLength - 2] << 8) | _header[_headerLength - 1];
+                }
+                _streamTotal = _remaining - read;
+                _streamOffset = 0;
+                _framing = FRAME_STREAM;
+                return;
+            }
+        }
+    }
+    _replayPos = 0;
+    _passRemaining = _remaining - read;
+    _framing = FRAME_PASS;
+}
+
+void StreamingClient::streamPayload() {
+    uint8_t chunk[STREAM_CHUNK_SIZE];
+    while (_streamOffset < _streamTotal) {
+        int available = _inner->available();
+        if (available <= 0) return;
+        size_t wanted = min((size_t)available, min((size_t)STREAM_CHUNK_SIZE, (size_t)(_streamTotal - _streamOffset)));
+        int n = _inner->read(chunk, wanted);
+        if (n <= 0) return;
+        (*_stream)(chunk, n, _streamOffset, _streamTotal);
+        _streamOffset += n;
+    }
+    if (_streamTotal == 0) {
+        (*_stream)(nullptr, 0, 0, 0);
+    }
+    if (_acknowledge) {
+        uint8_t puback[4] = { 0x40, 0x02, (uint8_t)(_packetId >> 8), (uint8_t)_packetId };
+        _inner->write(puback, sizeof(puback));
+    }
+    _framing = FRAME_HEADER;
+    _headerLength = 0;
+    _fixedLength = 0;
+    _stream = nullptr;
+}
+
+// A passed-through packet is done once PubSubClient has read all of it
+void StreamingClient::finishPass() {
+    if (_framing == FRAME_PASS && _replayPos == _headerLength && _passRemaining == 0) {
+        _framing = FRAME_HEADER;
+        _headerLength = 0;
+        _replayPos = 0;
+        _fixedLength = 0;
+    }
+}
+
+void StreamingClient::pump() {
+    for (;;) {
+        finishPass();
+        if (_framing == FRAME_HEADER) {
+            if (!readHeader()) return;
+            startPacket();
+        } else if (_framing == FRAME_STREAM) {
+            streamPayload();
+            if (_framing == FRAME_STREAM) return;
+        } else {
+            return;
+        }
+    }
+}
+
+int StreamingClient::available() {
+    pump();
+    if (_framing != FRAME_PASS) return 0;
+    if (_replayPos < _headerLength) return (int)(_headerLength - _replayPos);
+    int available = _inner->available();
+    if (available <= 0) return 0;
+    return (int)min((uint32_t)available, _passRemaining);
+}
+
+int StreamingClient::read() {
+    pump();
+    if (_framing != FRAME_PASS) return -1;
+    int b = -1;
+    if (_replayPos < _headerLength) {
+        b = _header[_replayPos++];
+    } else if (_passRemaining > 0) {
+        b = _inner->read();
+        if (b >= 0) _passRemaining--;
+    }
+    finishPass();
+    return b;
+}
+
+int StreamingClient::read(uint8_t* buffer, size_t size) {
+    size_t count = 0;
+    while (count < size && available() > 0) {
+        int b = read();
+        if (b < 0) break;
+        buffer[count++] = (uint8_t)b;
+    }
+    return count > 0 ? (int)count : -1;
+}
+
+int StreamingClient::peek() {
+    pump();
+    if (_framing != FRAME_PASS) return -1;
+    if (_replayPos < _headerLength) return _header[_replayPos];
+    return _passRemaining > 0 ? _inner->peek() : -1;
+}
+
+void JsonStreamParser::reset() {
+    _state = VALUE;
+    _depth = 0;
+    _arrays = 0;
+    _length = 0;
+}
+
+void JsonStreamParser::feed(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length && _state != FAILED; i++) {
+        // A literal ends at the first character that cannot belong to it,
+        // which is then read again in the next state
+        while (!step((char)data[i])) {}
+    }
+}
+
+void JsonStreamParser::fail() {
+    if (_state == FAILED) return;
+    _state = FAILED;
+    _handler(JSON_ERROR, nullptr, 0, _depth);
+}
+
+void JsonStreamParser::append(char c) {
+    if (_length < JSON_STREAM_TOKEN_MAX) _token[_length++] = c;
+}
+
+void JsonStreamParser::emit(JsonStreamEvent event) {
+    _token[_length] = '\0';
+    _handler(event, _token, _length, _depth);
+    _length = 0;
+}
+
+bool JsonStreamParser::open(bool array) {
+    if (_depth >= 32) {
+        fail();
+        return true;
+    }
+    _handler(array ? JSON_ARRAY_START : JSON_OBJECT_START, nullptr, 0, _depth);
+    if (array) _arrays |= (1UL << _depth);
+    else _arrays &= ~(1UL << _depth);
+    _depth++;
+    _state = array ? VALUE_OR_END : KEY_OR_END;
+    return true;
+}
+
+bool JsonStreamParser::close(bool array) {
+    bool isArray = _depth > 0 && (_arrays & (1UL << (_depth - 1)));
+    if (_depth == 0 || isArray != array) {
+        fail();
+        return true;
+    }
+    _depth--;
+    _handler(array ? JSON_ARRAY_END : JSON_OBJECT_END, nullptr, 0, _depth);
+    _state = _depth == 0 ? DONE : AFTER;
+    return true;
+}
+
+bool JsonStreamParser::finishLiteral() {
+    _token[_length] = '\0';
+    if (strcmp(_token, "true") == 0 || strcmp(_token, "false") == 0) {
+        emit(JSON_BOOL);
+    } else if (strcmp(_token, "null") == 0) {
+        emit(JSON_NULL);
+    } else {
+        char* end;
+        strtod(_token, &end);
+        if (end == _token || *end) {
+            fail();
+            return true;
+        }
+        emit(JSON_NUMBER);
+    }
+    _state = _depth == 0 ? DONE : AFTER;
+    return false;
+}
+
+// Returns false when the character has to be read again
+bool JsonStreamParser::step(char c) {
+    bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    switch (_state) {
+        case VALUE_OR_END:
+            if (space) return true;
+            if (c == ']') return close(true);
+            _state = VALUE;
+            return false;
+        case VALUE:
+            if (space) return true;
+            if (c == '{') return open(false);
+            if (c == '[') return open(true);
+            if (c == '"') {
+                _key = false;
+                _state = STRING;
+                return true;
+            }
+            if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+                append(c);
+                _state = LITERAL;
+                return true;
+            }
+            fail();
+            return true;
+        case KEY_OR_END:
+            if (space) return true;
+            if (c == '}') return close(false);
+            _state = KEY;
+            return false;
+        case KEY:
+            if (space) return true;
+            if (c != '"') {
+                fail();
+                return true;
+            }
+            _key = true;
+            _state = STRING;
+            return true;
+        case COLON:
+            if (space) return true;
+            if (c != ':') fail();
+            else _state = VALUE;
+            return true;
+        case AFTER:
+            if (space) return true;
+            if (c == ',') {
+                _state = (_arrays & (1UL << (_depth - 1))) ? VALUE : KEY;
+                return true;
+            }
+            if (c == '}') return close(false);
+            if (c == ']') return close(true);
+            fail();
+            return true;
+        case STRING:
+            if (c == '\\') {
+                _state = ESCAPE;
+            } else if (c == '"') {
+                emit(_key ? JSON_KEY : JSON_STRING);
+                _state = _key ? COLON : (_depth == 0 ? DONE : AFTER);
+            } else if ((uint8_t)c < 0x20) {
+                fail();
+            } else {
+                append(c);
+            }
+            return true;
+        case ESCAPE:
+            _state = STRING;
+            switch (c) {
+                case '"': case '\\': case '/': append(c); break;
+                case 'b': append('\b'); break;
+                case 'f': append('\f'); break;
+                case 'n': append('\n'); break;
+                case 'r': append('\r'); break;
+                case 't': append('\t'); break;
+                case 'u':
+                    _codepoint = 0;
+                    _digits = 0;
+                    _state = UNICODE;
+                    break;
+                default: fail();
+            }
+            return true;
+        case UNICODE: {
+            int digit = (c >= '0' && c <= '9') ? c - '0' :
+                        (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                        (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                fail();
+                return true;
+            }
+            _codepoint = (_codepoint << 4) | digit;
+            if (++_digits < 4) return true;
+            // UTF-8, surrogate pairs are kept as two 3-byte sequences
+            if (_codepoint < 0x80) {
+                append((char)_codepoint);
+            } else if (_codepoint < 0x800) {
+                append((char)(0xC0 | (_codepoint >> 6)));
+                append((char)(0x80 | (_codepoint & 0x3F)));
+            } else {
+                append((char)(0xE0 | (_codepoint >> 12)));
+                append((char)(0x80 | ((_codepoint >> 6) & 0x3F)));
+                append((char)(0x80 | (_codepoint & 0x3F)));
+            }
+            _state = STRING;
+            return true;
+        }
+        case LITERAL:
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E') {
+                append(c);
+                return true;
+            }
+            return finishLiteral();
+        case DONE:
+            if (!space) fail();
+            return true;
+        case FAILED:
+            return true;
+    }
+    return true;
 }
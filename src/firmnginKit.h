@@ -5,6 +5,7 @@
 #include <ArduinoJson.h>
 #include <PubSubClient.h>
 #include <time.h>
+#include <sys/time.h>
 #include <map>
 #include <functional>
 
@@ -19,12 +20,14 @@
 
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
 #include <WiFiClientSecure.h>
 #include <ESP8266HTTPClient.h>
 #define PLATFORM_SUPPORTED true
 #define PLATFORM_NAME "ESP8266"
 #elif defined(ESP32)
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <WiFiClientSecure.h>
 #include <HTTPClient.h>
 #define PLATFORM_SUPPORTED true
@@ -37,6 +40,62 @@
 // Default MQTT Server Configuration
 #define DEFAULT_MQTT_SERVER "asia-jkt1.firmngin.dev"
 #define DEFAULT_MQTT_PORT 8883
+#define DEFAULT_MQTT_KEEPALIVE 15
+
+// Transmit windows (see enableTransmitWindows): a window stays open at least
+// long enough for acks and pending downstream messages, and is closed by force
+// after the max. Between windows the radio is assumed to wake for
+// ~1% of the time to listen for DTIM beacons.
+#define TRANSMIT_WINDOW_MIN_MS 250
+#define TRANSMIT_WINDOW_MAX_MS 2000
+#define RADIO_SLEEP_DUTY_PERMILLE 10
+
+// Broker endpoints (see addMQTTServer)
+#define MAX_MQTT_ENDPOINTS 4
+// A probe is one TCP connect from loop(). WiFiClient has no non-blocking
+// connect, so it is capped at a small fraction of the keepalive; a broker
+// that takes longer than this is no failover candidate anyway.
+#define ENDPOINT_PROBE_TIMEOUT_MS 200
+#define ENDPOINT_PROBE_INTERVAL_MS 300000UL
+// Each recent failure counts like this much extra latency when ranking
+#define ENDPOINT_FAILURE_PENALTY_MS 1000
+// The active broker counts as degraded above this echo round trip
+#define ENDPOINT_DEGRADED_MS 1000
+
+// Bulk frames up to this size are copied on the stack (see handleBulkCommand)
+#define BULK_COPY_STACK 128
+
+// Edge rules (see setRules)
+#define MAX_EDGE_RULES 16
+#define RULE_FIRING_QUEUE 8
+
+// Streamed downstream messages (see onStream)
+#define STREAM_TOPIC_MAX 96
+#define STREAM_CHUNK_SIZE 128
+#define JSON_STREAM_TOKEN_MAX 64
+
+// LAN control channel (see enableLocalControl)
+#define LOCAL_CONTROL_PORT 4210
+#define LOCAL_CONTROL_MAX_PACKET 256
+// Epoch-ms sequence numbers further than this from the device clock are refused
+#define LOCAL_CONTROL_MAX_SKEW_MS 30000
+
+// Log levels. Sites above FNGIN_LOG_LEVEL are removed at compile time,
+// strings included; setDebug() still switches Serial output at runtime.
+#define FNGIN_LOG_NONE 0
+#define FNGIN_LOG_ERROR 1
+#define FNGIN_LOG_WARN 2
+#define FNGIN_LOG_INFO 3
+#define FNGIN_LOG_DEBUG 4
+#ifndef FNGIN_LOG_LEVEL
+#define FNGIN_LOG_LEVEL FNGIN_LOG_DEBUG
+#endif
+
+// Serial log site inside FirmnginKit: if (FNGIN_SERIAL_LOG(FNGIN_LOG_WARN)) { ... }
+#define FNGIN_SERIAL_LOG(level) (FNGIN_LOG_LEVEL >= (level) && _debug)
+// Binary event into the ring log (see enableEventLog), no formatting, no UART
+#define FNGIN_EVENT(level, event, a, b) \
+    do { if (FNGIN_LOG_LEVEL >= (level) && _eventLog) _eventLog->record((level), (event), (a), (b)); } while (0)
 
 #define OK "on_ok"
 
@@ -79,10 +138,581 @@ public:
 
 typedef std::function<void(DeviceState)> StateCallbackFunction;
 typedef std::function<void(String)> VirtualPinCallbackFunction;
+// Streamed payload chunk, offset + length == total on the last one
+typedef std::function<void(const uint8_t* data, size_t length, size_t offset, size_t total)> StreamCallbackFunction;
+
+// Memory profiles: presets for setMemoryBudget()
+enum MemoryProfile {
+    MEMORY_LOW,         // 3 KB  - ESP8266 sketches short on heap
+    MEMORY_BALANCED,    // 6 KB  - default, same sizes as previous releases
+    MEMORY_HIGH         // 16 KB - large batches and downstream payloads
+};
+
+#define MEMORY_BUDGET_LOW 3072
+#define MEMORY_BUDGET_BALANCED 6144
+#define MEMORY_BUDGET_HIGH 16384
+
+struct MemoryStats {
+    size_t budget;
+    uint16_t mqttBuffer;        // PubSubClient buffer (inbound messages)
+    uint16_t tlsRxBuffer;       // BearSSL receive buffer (ESP8266 only)
+    uint16_t tlsTxBuffer;       // BearSSL transmit buffer (ESP8266 only)
+    size_t arenaSize;           // shared JSON/output arena
+    size_t batchCapacity;       // JSON capacity of one BatchState
+    size_t arenaPeak;           // highest arena usage seen
+    size_t payloadPeak;         // largest serialized payload published
+    uint32_t arenaFallbacks;    // allocations that did not fit the arena
+    uint32_t credentialHeap;    // heap taken by TLS credential setup in begin()
+};
+
+// FirmnginArena: one pooled block shared by JSON documents (pushState,
+// BatchState) and their serialized output. Freeing the last block rewinds to
+// the end of the highest live one, so a BatchState kept alive only holds its
+// own space. Allocations that do not fit fall back to the heap.
+class FirmnginArena {
+public:
+    FirmnginArena() {}
+    ~FirmnginArena();
+
+    bool reserve(size_t size);
+    void* allocate(size_t size);
+    void deallocate(void* ptr);
+    void* reallocate(void* ptr, size_t size);
+    char* scratch(size_t size);
+
+    size_t size() const { return _size; }
+    size_t peak() const { return _peak; }
+    uint32_t fallbacks() const { return _fallbacks; }
+
+private:
+    uint8_t* _buffer = nullptr;
+    size_t _size = 0;
+    size_t _used = 0;
+    size_t _peak = 0;
+    size_t _live = 0;
+    uint32_t _fallbacks = 0;
+
+    bool owns(const void* ptr) const;
+};
+
+// ArduinoJson allocator backed by a FirmnginArena (heap when arena is null)
+#if ARDUINOJSON_VERSION_MAJOR >= 7
+class ArenaAllocator : public ArduinoJson::Allocator {
+public:
+    explicit ArenaAllocator(FirmnginArena* arena = nullptr) : _arena(arena) {}
+    void* allocate(size_t size) override { return _arena ? _arena->allocate(size) : malloc(size); }
+    void deallocate(void* ptr) override { if (_arena) _arena->deallocate(ptr); else free(ptr); }
+    void* reallocate(void* ptr, size_t size) override { return _arena ? _arena->reallocate(ptr, size) : realloc(ptr, size); }
+private:
+    FirmnginArena* _arena;
+};
+#else
+struct ArenaAllocator {
+    explicit ArenaAllocator(FirmnginArena* arena = nullptr) : _arena(arena) {}
+    void* allocate(size_t size) { return _arena ? _arena->allocate(size) : malloc(size); }
+    void deallocate(void* ptr) { if (_arena) _arena->deallocate(ptr); else free(ptr); }
+    void* reallocate(void* ptr, size_t size) { return _arena ? _arena->reallocate(ptr, size) : realloc(ptr, size); }
+    FirmnginArena* _arena;
+};
+typedef BasicJsonDocument<ArenaAllocator> PooledJsonDocument;
+#endif
+
+// JSON document allocated from an arena, for both ArduinoJson versions.
+// capacity is the fixed document size of ArduinoJson v6, v7 grows as needed.
+#if ARDUINOJSON_VERSION_MAJOR >= 7
+struct ArenaAllocatorHolder {
+    explicit ArenaAllocatorHolder(FirmnginArena* arena) : allocator(arena) {}
+    ArenaAllocator allocator;
+};
+
+// The allocator base is constructed before the document that uses it
+class ArenaJsonDocument : private ArenaAllocatorHolder, public JsonDocument {
+public:
+    ArenaJsonDocument(FirmnginArena* arena, size_t capacity)
+        : ArenaAllocatorHolder(arena), JsonDocument(&allocator) { (void)capacity; }
+};
+#else
+class ArenaJsonDocument : public PooledJsonDocument {
+public:
+    ArenaJsonDocument(FirmnginArena* arena, size_t capacity)
+        : PooledJsonDocument(capacity, ArenaAllocator(arena)) {}
+};
+#endif
+
+// SequenceWindow: recent sequenced payloads kept in RAM for retransmission.
+// Records are [seq:4][topic:1][length:2][payload], the oldest ones are
+// dropped when a new record does not fit.
+class SequenceWindow {
+public:
+    typedef std::function<void(uint32_t seq, uint8_t topic, const uint8_t* payload, size_t length)> Visitor;
+
+    explicit SequenceWindow(size_t size);
+    ~SequenceWindow();
+
+    bool store(uint32_t seq, uint8_t topic, const uint8_t* payload, size_t length);
+    void forEach(uint32_t from, uint32_t to, const Visitor& visit) const;
+    uint32_t oldest() const;
+    size_t size() const { return _size; }
+
+private:
+    static const size_t RECORD_HEADER = 7;
+
+    uint8_t* _buffer;
+    size_t _size;
+    size_t _head = 0;
+    size_t _tail = 0;
+
+    void dropOldest();
+};
+
+// Latency tracing routes (see enableLatencyTracing)
+enum TraceRoute {
+    TRACE_PAYMENT,          // pm
+    TRACE_PAYMENT_SUCCESS,  // mos
+    TRACE_VPIN,             // /rs/{vpin}
+    TRACE_OTHER,
+    TRACE_ROUTE_COUNT
+};
+
+struct LatencyStats {
+    uint32_t count;
+    uint32_t p50Ms;         // server timestamp -> callback finished
+    uint32_t p99Ms;
+    uint32_t maxMs;
+    uint32_t handlerP50Us;  // arrival in mqttCallback -> callback finished
+    uint32_t handlerP99Us;
+};
+
+// LatencyHistogram: fixed log-scale buckets, 4 per power of two up to ~131k.
+// Counts are halved when a bucket saturates, so old samples fade out.
+class LatencyHistogram {
+public:
+    static const uint8_t BUCKETS = 64;
+
+    void add(uint32_t value);
+    uint32_t percentile(uint8_t pct) const;
+    uint32_t count() const { return _count; }
+    uint32_t maximum() const { return _max; }
+
+private:
+    uint16_t _buckets[BUCKETS] = {};
+    uint32_t _count = 0;
+    uint32_t _max = 0;
+
+    static uint8_t bucketOf(uint32_t value);
+    static uint32_t bucketStart(uint8_t index);
+};
+
+class LatencyTracer {
+public:
+    void observe(int64_t arrivalMinusServerMs);
+    void record(TraceRoute route, int64_t endToEndMs, uint32_t handlerUs);
+    LatencyStats stats(TraceRoute route) const;
+    int32_t clockOffset() const;
+    void exportJson(JsonDocument& doc) const;
+
+private:
+    static const uint8_t OFFSET_WINDOW = 64;
+
+    LatencyHistogram _endToEnd[TRACE_ROUTE_COUNT];
+    LatencyHistogram _handler[TRACE_ROUTE_COUNT];
+    int64_t _minDelta = INT32_MAX;
+    int64_t _previousMinDelta = INT32_MAX;
+    uint8_t _offsetSamples = 0;
+};
+
+// Outbound priority lanes (see enableScheduler), drained in this order
+enum OutboundLane {
+    LANE_CONTROL,   // endSession, gap reports
+    LANE_STATE,     // pushState, BatchState, retransmits
+    LANE_BULK,      // TimeSeries blocks, latency reports
+    LANE_COUNT
+};
+
+// OutboundScheduler::submit() result
+enum SubmitResult : uint8_t {
+    SUBMIT_DROPPED,         // queue full or out of memory
+    SUBMIT_SENT,
+    SUBMIT_QUEUED           // sent later from drain()
+};
+
+struct LaneStats {
+    uint8_t queued;
+    uint32_t sent;
+    uint32_t dropped;       // queue was full
+    uint32_t failed;        // given up after OutboundScheduler::MAX_SEND_ATTEMPTS
+};
+
+struct BrokerEndpoint {
+    String host;
+    int port;
+    uint32_t probeMs;       // smoothed TCP connect time, 0 = not measured yet (ranking)
+    uint32_t connectMs;     // last full connect: TCP, TLS and CONNACK
+    uint32_t echoMs;        // smoothed broker round trip while active, 0 = none (health)
+    uint8_t failures;       // failed probes/connects since the last success
+    IPAddress address;      // resolved on the first probe, again after a failure
+    bool resolved;
+};
+
+struct LocalControlStats {
+    uint32_t commands;          // accepted datagrams
+    uint32_t rejected;          // bad format or signature
+    uint32_t stale;             // replayed or outside the clock skew, not replied to
+    uint32_t lastHandlerUs;     // datagram in -> reply sent
+    uint32_t maxHandlerUs;
+};
+
+struct RadioStats {
+    uint32_t windows;
+    uint32_t windowPeriodMs;
+    uint32_t awakeMs;           // inside transmit windows
+    uint32_t sleepMs;           // between windows
+    uint32_t onMsPerHour;       // estimated radio-on time per hour
+    uint32_t maxHeldMs;         // longest a message waited for its window
+};
+
+// TokenBucket: rate limit in units per second. Tokens are kept in thousandths
+// so fractional rates work with integers, refills too small for a whole
+// thousandth are carried over to the next call.
+class TokenBucket {
+public:
+    void configure(uint32_t milliRate, uint32_t milliCapacity);
+    void refill(unsigned long elapsedMs);
+    bool allows(uint32_t units) const;
+    void take(uint32_t units);
+    uint32_t tokens() const { return _tokens; }
+
+private:
+    uint32_t _rate = 0;         // thousandths per second, 0 = unlimited
+    uint32_t _tokens = 0;
+    uint32_t _capacity = 0;
+    uint32_t _carry = 0;        // refill remainder, millionths of a unit
+};
+
+// OutboundScheduler: per-lane queues with token buckets on messages and
+// bytes per second. A message goes out immediately when its lane and all
+// higher lanes are empty and tokens are available, otherwise it is copied
+// into the lane queue and sent from drain(). A queued message the sender
+// keeps refusing is dropped after MAX_SEND_ATTEMPTS and counted as failed.
+class OutboundScheduler {
+public:
+    typedef std::function<bool(const char* topic, const uint8_t* payload, size_t length, bool retained)> Sender;
+
+    static const uint8_t MAX_SEND_ATTEMPTS = 3;
+
+    OutboundScheduler(uint8_t depth, Sender sender);
+    ~OutboundScheduler();
+
+    void setRate(OutboundLane lane, float messagesPerSec, uint32_t bytesPerSec);
+    SubmitResult submit(OutboundLane lane, const char* topic, const uint8_t* payload, size_t length, bool retained);
+    void drain();
+    LaneStats stats(OutboundLane lane) const;
+    // While held, only LANE_CONTROL is sent, everything else waits for drain()
+    void hold(bool held) { _held = held; }
+    bool empty() const;
+    uint32_t maxWait() const { return _maxWaitMs; }
+
+private:
+    struct Message {
+        uint8_t* data;              // topic, '\0', payload in one block
+        size_t length;
+        bool retained;
+        uint8_t attempts;           // refused by the sender so far
+        unsigned long queuedAt;
+    };
+
+    struct Lane {
+        Message* queue = nullptr;
+        uint8_t head = 0;
+        uint8_t count = 0;
+        TokenBucket messages;
+        TokenBucket bytes;
+        uint32_t sent = 0;
+        uint32_t dropped = 0;
+        uint32_t failed = 0;
+    };
+
+    Lane _lanes[LANE_COUNT];
+    uint8_t _depth;
+    Sender _sender;
+    unsigned long _lastRefill;
+    bool _held = false;
+    uint32_t _maxWaitMs = 0;
+
+    void refill();
+    void pop(Lane& lane);
+    bool ready(Lane& lane, size_t length) const;
+    bool send(Lane& lane, const char* topic, const uint8_t* payload, size_t length, bool retained);
+};
+
+// Ring log events, a/b meaning per event
+enum LogEvent : uint8_t {
+    LOG_TIME_SYNC,          // a: 1 synced, 0 failed
+    LOG_MQTT_CONNECTING,    // a: attempt, b: endpoint
+    LOG_MQTT_CONNECTED,     // a: connect ms, b: endpoint
+    LOG_MQTT_FAILED,        // a: PubSubClient state, b: attempt
+    LOG_MQTT_LOST,          // b: endpoint
+    LOG_ENDPOINT_PROBE,     // a: TCP connect ms (-1 unreachable), b: endpoint
+    LOG_ENDPOINT_SWITCH,    // a: from, b: to
+    LOG_PUBLISH_FAILED,     // a: payload bytes, b: lane
+    LOG_PUSH_OFFLINE,       // a: key
+    LOG_MESSAGE,            // a: payload bytes
+    LOG_VPIN_UNHANDLED,     // a: vpin
+    LOG_RETRANSMIT,         // a: from, b: to
+    LOG_RULES_LOADED,       // a: rules, b: 1 compiled, 0 rejected
+    LOG_LOCAL_COMMAND,      // a: handler us
+    LOG_LOCAL_REJECTED,     // a: 1 bad signature, 2 stale
+    LOG_EVENT_COUNT
+};
+
+// EventLog: fixed ring of 12-byte records, the oldest is overwritten.
+// Recording is a few stores, cheap enough for the publish and callback paths.
+class EventLog {
+public:
+    struct Record {
+        uint32_t ms;
+        int32_t a;
+        int16_t b;
+        uint8_t event;
+        uint8_t level;
+    };
+
+    explicit EventLog(uint16_t capacity);
+    ~EventLog();
+
+    void record(uint8_t level, LogEvent event, int32_t a, int32_t b) {
+        Record& entry = _records[_next];
+        entry.ms = millis();
+        entry.a = a;
+        entry.b = (int16_t)b;
+        entry.event = event;
+        entry.level = level;
+        _next = (_next + 1) % _capacity;
+        if (_count < _capacity) _count++;
+        else _overwritten++;
+    }
+    // index 0 is the oldest record
+    const Record& at(uint16_t index) const {
+        return _records[(_next + _capacity - _count + index) % _capacity];
+    }
+    uint16_t size() const { return _count; }
+    uint32_t overwritten() const { return _overwritten; }
+    void dump(Print& out) const;
+    void clear() { _count = 0; }
+
+private:
+    Record* _records;
+    uint16_t _capacity;
+    uint16_t _next = 0;
+    uint16_t _count = 0;
+    uint32_t _overwritten = 0;
+};
+
+// StateShadow: last value per state key, with a dirty bit per key for
+// values the server has not seen yet. A key keeps its slot for the
+// session, so the dirty set is one bit per key.
+class StateShadow {
+public:
+    explicit StateShadow(uint16_t capacity);
+    ~StateShadow();
+
+    // delivered: the value reached the broker. False if it was pushed
+    // offline, only queued, or the publish failed; the key is then dirty
+    // even if the value equals the last one. Returns false once all slots
+    // are taken.
+    bool update(const String& key, const String& value, bool delivered);
+    bool dirty(uint16_t slot) const { return _dirty[slot >> 5] & (1UL << (slot & 31)); }
+    void markClean(uint16_t slot);
+    const String& key(uint16_t slot) const { return *_keys[slot]; }
+    const String& value(uint16_t slot) const { return _values[slot]; }
+    uint16_t size() const { return _size; }
+    uint16_t capacity() const { return _capacity; }
+    uint16_t dirtyCount() const { return _dirtyCount; }
+
+private:
+    std::map<String, uint16_t> _slots;
+    const String** _keys;       // into _slots, map nodes do not move
+    String* _values;
+    uint32_t* _dirty;
+    uint16_t _capacity;
+    uint16_t _size = 0;
+    uint16_t _dirtyCount = 0;
+};
+
+// StreamingClient: sits between PubSubClient and the network client and
+// reads the MQTT framing. Inbound PUBLISH packets on a registered topic are
+// handed to their callback in chunks as they arrive, and acknowledged here,
+// so they never go through the PubSubClient buffer. Everything else is
+// passed through unchanged.
+class StreamingClient : public Client {
+public:
+    explicit StreamingClient(Client& inner) : _inner(&inner) {}
+
+    void setInner(Client& inner) { _inner = &inner; resetFraming(); }
+    void add(const String& topic, StreamCallbackFunction callback) { _callbacks[topic] = callback; }
+    const std::map<String, StreamCallbackFunction>& callbacks() const { return _callbacks; }
+
+    int connect(IPAddress ip, uint16_t port) override { resetFraming(); return _inner->connect(ip, port); }
+    int connect(const char* host, uint16_t port) override { resetFraming(); return _inner->connect(host, port); }
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) override { resetFraming(); return _inner->connect(ip, port, timeout); }
+    int connect(const char* host, uint16_t port, int32_t timeout) override { resetFraming(); return _inner->connect(host, port, timeout); }
+#endif
+    size_t write(uint8_t b) override { return _inner->write(b); }
+    size_t write(const uint8_t* buffer, size_t size) override { return _inner->write(buffer, size); }
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override { _inner->flush(); }
+    void stop() override { resetFraming(); _inner->stop(); }
+    uint8_t connected() override { return _inner->connected(); }
+    operator bool() override { return connected(); }
+
+private:
+    Client* _inner;
+    std::map<String, StreamCallbackFunction> _callbacks;
+
+    // Packet header as read so far, replayed to PubSubClient when not streamed
+    uint8_t _header[5 + 2 + STREAM_TOPIC_MAX + 2];
+    size_t _headerLength = 0;
+    size_t _replayPos = 0;
+    size_t _fixedLength = 0;        // type byte + remaining length bytes
+    uint32_t _remaining = 0;        // remaining length of the current packet
+    uint32_t _passRemaining = 0;    // bytes after the replay that go to PubSubClient
+
+    enum Framing : uint8_t { FRAME_HEADER, FRAME_PASS, FRAME_STREAM };
+    Framing _framing = FRAME_HEADER;
+    StreamCallbackFunction* _stream = nullptr;
+    uint32_t _streamOffset = 0;
+    uint32_t _streamTotal = 0;
+    uint16_t _packetId = 0;
+    bool _acknowledge = false;
+
+    void resetFraming();
+    void pump();
+    bool readHeader();
+    void startPacket();
+    void streamPayload();
+    void finishPass();
+};
+
+enum JsonStreamEvent : uint8_t {
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_KEY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_BOOL,
+    JSON_NULL,
+    JSON_ERROR
+};
+
+// JsonStreamParser: incremental JSON tokenizer for streamed payloads. Feed it
+// chunks in order, it calls the handler for every token with its nesting
+// depth. Only the current token is buffered; strings and numbers longer
+// than JSON_STREAM_TOKEN_MAX are cut off.
+class JsonStreamParser {
+public:
+    typedef std::function<void(JsonStreamEvent event, const char* value, size_t length, uint8_t depth)> Handler;
+
+    explicit JsonStreamParser(Handler handler) : _handler(handler) {}
+
+    void feed(const uint8_t* data, size_t length);
+    void reset();
+    bool failed() const { return _state == FAILED; }
+    bool done() const { return _state == DONE; }
+
+private:
+    enum State : uint8_t {
+        VALUE, VALUE_OR_END, KEY, KEY_OR_END, COLON, AFTER,
+        STRING, ESCAPE, UNICODE, LITERAL, DONE, FAILED
+    };
+
+    Handler _handler;
+    State _state = VALUE;
+    uint8_t _depth = 0;
+    uint32_t _arrays = 0;       // bit per level: 1 = array, 0 = object
+    bool _key = false;
+    char _token[JSON_STREAM_TOKEN_MAX + 1];
+    uint8_t _length = 0;
+    uint16_t _codepoint = 0;
+    uint8_t _digits = 0;
+
+    bool step(char c);
+    bool open(bool array);
+    bool close(bool array);
+    bool finishLiteral();
+    void append(char c);
+    void emit(JsonStreamEvent event);
+    void fail();
+};
+
+enum RuleOp : uint8_t { RULE_GT, RULE_GE, RULE_LT, RULE_LE, RULE_EQ, RULE_NE };
+
+struct RuleFiring {
+    uint8_t rule;           // index in the rule text
+    bool released;          // condition went false, release action applied
+    int target;
+    int32_t action;
+    float sample;           // source value that crossed the threshold
+    uint64_t epochMs;
+};
+
+// EdgeRules: "source op threshold : target = value [| release]" compiled
+// into a flat table. A rule fires when its condition becomes true, and
+// applies the release value (if any) when it becomes false again.
+//   "10>30:5=1;10<28:5=0"   relay on VPin 5 above 30, off below 28
+class EdgeRules {
+public:
+    typedef std::function<void(int vpin, int32_t value)> Action;
+
+    explicit EdgeRules(Action action) : _action(action) {}
+
+    // Replaces the table; on a syntax error the old rules stay and false is returned
+    bool compile(const char* text, size_t length);
+    void evaluate(int vpin, float value, uint64_t epochMs);
+    uint8_t count() const { return _count; }
+    bool nextFiring(RuleFiring& firing);
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    struct Rule {
+        int16_t source;
+        int16_t target;
+        RuleOp op;
+        bool hasRelease;
+        bool active;
+        float threshold;
+        int32_t value;
+        int32_t release;
+    };
+
+    Rule _rules[MAX_EDGE_RULES];
+    uint8_t _count = 0;
+    Action _action;
+    RuleFiring _firings[RULE_FIRING_QUEUE];
+    uint8_t _firingHead = 0;
+    uint8_t _firingCount = 0;
+    uint32_t _dropped = 0;
+
+    static bool parseRule(const char* text, size_t length, Rule& rule);
+    static bool sameRule(const Rule& a, const Rule& b);
+    void queueFiring(uint8_t index, bool released, int32_t action, float sample, uint64_t epochMs);
+};
 
 class FirmnginKit;
 class BatchState;
-extern FirmnginKit* _globalFirmnginKitInstance;
+class VPinBase;
+
+// Storage of the instance used by BatchState/VPin. extras/loadgen builds
+// with thread_local to run one simulated device per thread.
+#ifndef FNGIN_INSTANCE_STORAGE
+#define FNGIN_INSTANCE_STORAGE
+#endif
+extern FNGIN_INSTANCE_STORAGE FirmnginKit* _globalFirmnginKitInstance;
 
 class FirmnginKit
 {
@@ -100,11 +730,38 @@ public:
     void begin();
     void loop();
     void setDebug(bool debug);
+    bool isDebug() const { return FNGIN_SERIAL_LOG(FNGIN_LOG_WARN); }
     void setTimezone(int timezone);
     void setDaylightOffsetSec(int daylightOffsetSec);
     void setNtpServer(const char *ntpServer);
     void setMQTTServer(const char* server, int port);
+    bool addMQTTServer(const char* server, int port = DEFAULT_MQTT_PORT);
+    void setProbeInterval(unsigned long ms);
+    uint8_t getMQTTServerCount() { return _endpointCount; }
+    const BrokerEndpoint* getMQTTServer(uint8_t index);
+    int getActiveMQTTServer() { return _activeEndpoint; }
     void setClient(Client& client);
+    void setClientCertDer(const uint8_t* der, size_t length);
+    void setPrivateKeyDer(const uint8_t* der, size_t length);
+    void setCACertDer(const uint8_t* der, size_t length);
+    unsigned long getTlsReadyMillis() const { return _tlsReadyMillis; }
+    void setMemoryBudget(size_t bytes);
+    void setMemoryProfile(MemoryProfile profile);
+    MemoryStats getMemoryStats();
+    void enableSequencing(size_t windowBytes = 2048);
+    uint32_t getSequence() const { return _sequence; }
+    void enableScheduler(uint8_t queueDepth = 16);
+    void setLaneRate(OutboundLane lane, float messagesPerSec, uint32_t bytesPerSec);
+    LaneStats getLaneStats(OutboundLane lane);
+    void enableTransmitWindows(uint32_t maxLatencyMs = 5000, bool lightSleep = false);
+    RadioStats getRadioStats();
+    void enableLatencyTracing();
+    LatencyStats getLatencyStats(TraceRoute route);
+    int32_t getClockOffset();
+    String exportLatency();
+    bool publishLatencyReport();
+    static uint64_t epochMicros();
+    static uint64_t epochMillis() { return epochMicros() / 1000; }
     bool isPlatformSupported();
     FirmnginKit &endSession();
 
@@ -121,8 +778,28 @@ public:
     void pushState(int key, double value);
     BatchState pushBatchState();
     bool publishBatchState(String payload);
+    bool publishBatchState(const JsonDocument& doc);
+    bool publishTimeSeries(const uint8_t* block, size_t length);
+    FirmnginArena* arena() { return &_arena; }
+    size_t batchCapacity() const { return _batchCapacity; }
     void onVirtualPin(int pinId, VirtualPinCallbackFunction callback);
     void registerVirtualPin(int pinId, VirtualPinCallbackFunction callback);
+    void bindVPin(VPinBase& pin);
+    void enableGroupedWrite(bool enabled = true);
+    bool setRules(const char* rules);
+    uint8_t getRuleCount() { return _edgeRules ? _edgeRules->count() : 0; }
+    bool hasRules() const { return _edgeRules && _edgeRules->count() > 0; }
+    void evaluateRules(int vpin, float value);
+    bool enableLocalControl(uint16_t port = LOCAL_CONTROL_PORT);
+    LocalControlStats getLocalControlStats() { return _localStats; }
+    void enableEventLog(uint16_t records = 64);
+    void dumpLog(Print& out);
+    bool publishEventLog();
+    void enableStateShadow(uint16_t maxKeys = 128);
+    bool publishStateSnapshot() { return publishShadow(true); }
+    uint16_t getDirtyStateCount() { return _shadow ? _shadow->dirtyCount() : 0; }
+    void onStream(const char* topic, StreamCallbackFunction callback);
+    void onStreamJson(const char* topic, JsonStreamParser::Handler handler);
 
 private:
     const char *_deviceId;
@@ -144,26 +821,98 @@ private:
     String _mqttServer;
     int _mqttPort;
 
+    // Memory budget (see setMemoryBudget), the constructor applies MEMORY_BALANCED
+    size_t _memoryBudget = MEMORY_BUDGET_BALANCED;
+    uint16_t _mqttBufferSize = 2048;
+    uint16_t _tlsRxBufferSize = 512;
+    uint16_t _tlsTxBufferSize = 512;
+    size_t _arenaSize = 3072;
+    size_t _batchCapacity = 2048;
+    size_t _payloadPeak = 0;
+    FirmnginArena _arena;
+
+    // Sequenced telemetry (see enableSequencing)
+    enum SequencedTopic : uint8_t { SEQ_NONE, SEQ_PUSH_STATE, SEQ_PUSH_BATCH };
+    SequenceWindow* _sequenceWindow = nullptr;
+    uint32_t _sequence = 0;
+
+    LatencyTracer* _latencyTracer = nullptr;
+    OutboundScheduler* _scheduler = nullptr;
+    unsigned long _lastReconnectAttempt = 0;
+    BrokerEndpoint _endpoints[MAX_MQTT_ENDPOINTS];
+    uint8_t _endpointCount = 0;
+    int _activeEndpoint = -1;
+    bool _endpointSwitch = false;
+    bool _mqttWasConnected = false;
+    unsigned long _probeInterval = ENDPOINT_PROBE_INTERVAL_MS;
+    unsigned long _lastProbe = 0;
+    uint8_t _probeCursor = 0;
+    unsigned long _echoSentAt = 0;
+    bool _transmitWindows = false;
+    bool _lightSleep = false;
+    bool _windowOpen = false;
+    unsigned long _windowPeriod = 0;
+    unsigned long _windowStart = 0;       // phase-aligned schedule
+    unsigned long _windowOpenedAt = 0;    // when the current window really opened
+    unsigned long _windowClosed = 0;
+    uint32_t _windowCount = 0;
+    uint32_t _awakeMs = 0;
+    uint32_t _sleepMs = 0;
+    unsigned long _backoffDelay = 5000;
+
 #if defined(ESP8266)
     const char* _clientCert = nullptr;
     const char* _privateKey = nullptr;
     const uint8_t* _fingerprint = nullptr;
     BearSSL::X509List *_clientCertList = nullptr;
     BearSSL::PrivateKey *_clientPrivKey = nullptr;
+    BearSSL::X509List *_caCertList = nullptr;
 #elif defined(ESP32)
     const char* _caCert = nullptr;
     const char* _clientCert = nullptr;
     const char* _privateKey = nullptr;
     const uint8_t* _fingerprint = nullptr;
+    char* _caCertPem = nullptr;
+    char* _clientCertPem = nullptr;
+    char* _privateKeyPem = nullptr;
 #endif
 
+    // DER credentials (see setClientCertDer)
+    const uint8_t* _clientCertDer = nullptr;
+    size_t _clientCertDerLength = 0;
+    const uint8_t* _privateKeyDer = nullptr;
+    size_t _privateKeyDerLength = 0;
+    const uint8_t* _caCertDer = nullptr;
+    size_t _caCertDerLength = 0;
+    uint32_t _credentialHeap = 0;
+    unsigned long _beginMillis = 0;
+    unsigned long _tlsReadyMillis = 0;
+
     std::map<String, StateCallbackFunction> _stateCallbacks;
     std::map<String, StateCallbackFunction> _commandCallbacks;
     std::map<int, VirtualPinCallbackFunction> _virtualPinCallbacks;
+    std::map<int, VPinBase*> _boundPins;
+    bool _groupedWrite = false;
+    EdgeRules* _edgeRules = nullptr;
+    WiFiUDP* _localUdp = nullptr;
+    uint64_t _localSequence = 0;
+    char _localNonce[9] = {0};              // per boot, binds LAN signatures to it
+    LocalControlStats _localStats = {};
+    std::map<int, String> _localPending;    // LAN and rule changes not yet mirrored to the cloud
+    EventLog* _eventLog = nullptr;
+    StreamingClient* _streamingClient = nullptr;
+    bool _streamingAttached = false;        // PubSubClient reads through _streamingClient
+    std::map<String, JsonStreamParser*> _streamParsers;
+    StateShadow* _shadow = nullptr;
 
-    void _Debug(String message, bool newLine = true);
     bool connectServer();
+#if defined(ESP32)
+    bool attachDerCredentials();
+    void releaseDerCredentials();
+#endif
     void mqttCallback(char *topic, byte *payload, unsigned int length);
+    void dispatchMessage(const String& topicStr, const String& payloadStr);
+    void dispatchVirtualPin(int vpinId, const String& payload);
     String getPaymentSuccess(String deviceId);
     String getDeviceStatus(String deviceId);
     String getPaymentPending(String deviceId);
@@ -174,37 +923,85 @@ private:
     String getVirtualPinTopic(String deviceId, int vpin);
     String getPushStateTopic(String deviceId);
     String getPushBatchStateTopic(String deviceId);
+    String getTimeSeriesTopic(String deviceId);
+    String getRetransmitTopic(String deviceId);
+    String getLatencyTopic(String deviceId);
+    String getGapTopic(String deviceId);
+    String getBulkTopic(String deviceId);
+    String getEchoTopic(String deviceId);
+    String getRulesTopic(String deviceId);
+    String getRuleFiringTopic(String deviceId);
+    String getEventLogTopic(String deviceId);
+    String getStateDeltaTopic(String deviceId);
+    String getStateRequestTopic(String deviceId);
+    bool isDeviceTopic(const char* topic, const char* suffix);
+    void handleBulkCommand(const char* payload, size_t length);
+    void recordShadow(const JsonDocument& doc, bool delivered);
+    bool publishShadow(bool full);
     void syncTime();
     void setupLWT();
+    bool publishJson(const String& topic, const JsonDocument& doc, SequencedTopic sequenced = SEQ_NONE, OutboundLane lane = LANE_STATE);
+    SubmitResult submitJson(const String& topic, const JsonDocument& doc, SequencedTopic sequenced = SEQ_NONE, OutboundLane lane = LANE_STATE);
+    SubmitResult submitBuffer(const char* topic, const uint8_t* payload, size_t length, OutboundLane lane = LANE_STATE, bool retained = false);
+    bool publishBuffer(const char* topic, const uint8_t* payload, size_t length, OutboundLane lane = LANE_STATE, bool retained = false);
+    bool publishNow(const char* topic, const uint8_t* payload, size_t length, bool retained);
+    SubmitResult publishSequencedBatch(const char* json, size_t jsonLength, const JsonDocument* doc);
+    void handleRetransmitRequest(const String& payload);
+    void openTransmitWindow(unsigned long now);
+    void closeTransmitWindow(unsigned long now);
+    void setRadioSleep(bool sleep);
+    bool probeEndpoint(BrokerEndpoint& endpoint);
+    uint32_t endpointScore(const BrokerEndpoint& endpoint);
+    int bestEndpoint();
+    void selectEndpoint(int index);
+    void probeEndpoints();
+    void handleEcho(const byte* payload, unsigned int length);
+    bool loadRules(const char* rules, size_t length);
+    void applyRuleAction(int vpin, int32_t value);
+    void publishRuleFirings();
+    void pollLocalControl();
+    void handleLocalPacket(char* packet, size_t length);
+    void signLocal(const char* message, size_t length, uint8_t* mac, bool withNonce);
+    void replyLocal(const char* seq, const char* status, uint32_t handlerUs);
+    void sendLocal(char* reply, int length, bool withNonce);
+    void publishLocalState();
 };
 
 void onVirtualPin(int pinId, VirtualPinCallbackFunction callback);
 
+// HMAC-SHA256 over the concatenated parts, mac receives 32 bytes
+void hmacSha256(const uint8_t* key, size_t keyLength, const char* const* parts, const size_t* lengths, size_t count, uint8_t* mac);
+
 // BatchState: Builder pattern for batch push
+// Documents are built in the instance's pooled arena (see setMemoryBudget).
+// While a BatchState lives, its document stays in the arena; pushState and
+// later batches use the space above it.
 class BatchState {
 private:
-#if ARDUINOJSON_VERSION_MAJOR >= 7
-  JsonDocument _doc;
-#else
-  DynamicJsonDocument _doc;
-#endif
+  ArenaJsonDocument _doc;
   JsonArray _array;
+  uint16_t _dropped = 0;
   
-public:
-#if ARDUINOJSON_VERSION_MAJOR >= 7
-  BatchState() {
-    _array = _doc.to<JsonArray>();
+  static FirmnginArena* instanceArena() {
+    return _globalFirmnginKitInstance ? _globalFirmnginKitInstance->arena() : nullptr;
   }
-#else
-  BatchState() : _doc(2048) {
+
+public:
+  BatchState()
+    : _doc(instanceArena(), _globalFirmnginKitInstance ? _globalFirmnginKitInstance->batchCapacity() : 2048) {
     _array = _doc.to<JsonArray>();
   }
-#endif
   
+  // An entry that does not fit the document (ArduinoJson v6 has a fixed
+  // capacity, see batchCapacity()) is left out and counted in dropped()
   BatchState& add(String key, String value) {
     JsonObject obj = _array.JSON_ARRAY_ADD_OBJECT();
-    obj["key"] = key;
-    obj["value"] = value;
+    if (obj.isNull()) {
+      _dropped++;
+    } else if (!obj["key"].set(key) || !obj["value"].set(value)) {
+      _array.remove(_array.size() - 1);
+      _dropped++;
+    }
     return *this;
   }
   
@@ -251,45 +1048,217 @@ public:
     return add(String(key), value);
   }
   
+  // Publishes the entries that fit. False when nothing was published, and
+  // also when entries were dropped: dropped() tells how many.
   bool send() {
-    if (_globalFirmnginKitInstance) {
-      String payload;
-      serializeJson(_doc, payload);
-      return _globalFirmnginKitInstance->publishBatchState(payload);
+    if (!_globalFirmnginKitInstance) return false;
+    bool published = _globalFirmnginKitInstance->publishBatchState(_doc);
+    if (_dropped > 0 && _globalFirmnginKitInstance->isDebug()) {
+      Serial.print("BatchState full, entries dropped: ");
+      Serial.println(_dropped);
     }
-    return false;
+    return published && _dropped == 0;
   }
   
   int count() { return _array.size(); }
-  void clear() { _array.clear(); }
+  uint16_t dropped() const { return _dropped; }
+  void clear() {
+    _array.clear();
+    _dropped = 0;
+  }
+};
+
+// TimeSeries: timestamped samples for one VPin, delta-encoded into compact
+// blocks in RAM and published as one binary message per block on /d/{id}/ts.
+// Two blocks are used so capture continues while the other one is sent;
+// when both are full new samples are dropped and counted.
+//
+// Block layout (little-endian):
+//   [version:1][vpin:2][decimals:1][count:2][t0 epoch us:8][v0 varint]
+//   then per sample: [zigzag varint delta-of-delta us][zigzag varint value delta]
+//
+// record() is cheap (no allocation, no I/O), call send() from loop().
+class TimeSeries {
+public:
+  TimeSeries(int vpin, size_t blockBytes = 512, uint8_t decimals = 0);
+  ~TimeSeries();
+
+  bool record(int32_t value) { return record(value, micros()); }
+  bool record(int32_t value, uint32_t timestampMicros);
+  bool record(float value);
+
+  int send();
+  void flush();
+  const uint8_t* nextBlock(size_t& length);
+
+  uint32_t samples() const { return _samples; }
+  uint32_t dropped() const { return _dropped; }
+  int getVpin() const { return _vpin; }
+
+  // Encoding of the block fields, returns the end of what was written
+  static uint8_t* writeVarint(uint8_t* out, uint64_t value);
+  static uint64_t zigzag(int64_t value);
+
+private:
+  static const size_t HEADER_SIZE = 14;
+  static const size_t MAX_SAMPLE_SIZE = 20;
+
+  struct Block {
+    uint8_t* data;
+    size_t length;
+    uint16_t count;
+    bool sealed;
+    uint32_t sealOrder;
+    uint32_t lastMicros;
+    int32_t lastDelta;
+    int32_t lastValue;
+  };
+
+  int _vpin;
+  size_t _blockBytes;
+  uint8_t _decimals;
+  int32_t _scale;
+  uint8_t* _storage;
+  Block _blocks[2];
+  uint8_t _active = 0;
+  uint32_t _sealCounter = 0;
+  uint32_t _samples = 0;
+  uint32_t _dropped = 0;
+
+  void startBlock(Block& block, int32_t value, uint32_t timestampMicros);
+  void seal(Block& block);
+  Block* oldestSealed();
 };
 
 // GPIO mode enum
 enum PinMode { NONE, DIGITAL, PWM, ACTIVE_LOW };
 
-// VPin: Unified Virtual Pin for both receive and push
-// - Receive: control GPIO from server commands
-// - Push: send sensor data with smart conditions
-class VPin {
+// "ON", "HIGH" and "1" in any case switch a digital VPin on
+inline bool vpinStateOn(const char* value, size_t length) {
+  return (length == 1 && value[0] == '1') ||
+         (length == 2 && strncasecmp(value, "ON", 2) == 0) ||
+         (length == 4 && strncasecmp(value, "HIGH", 4) == 0);
+}
+
+// Like String::toInt() on a value that is not null-terminated
+inline long vpinParseInt(const char* value, size_t length) {
+  size_t i = 0;
+  while (i < length && value[i] == ' ') i++;
+  bool negative = i < length && value[i] == '-';
+  if (i < length && (value[i] == '-' || value[i] == '+')) i++;
+  long result = 0;
+  for (; i < length && value[i] >= '0' && value[i] <= '9'; i++) {
+    result = result * 10 + (value[i] - '0');
+  }
+  return negative ? -result : result;
+}
+
+// Writes value / 10^decimals as text, e.g. (-5, 2) -> "-0.05".
+// Integer only, so no soft-float or printf on the ESP8266.
+// out needs room for 13 characters.
+inline void vpinFormatFixed(char* out, int32_t value, uint8_t decimals) {
+  char digits[12];
+  uint8_t n = 0;
+  uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude || n <= decimals);
+  if (value < 0) *out++ = '-';
+  while (n) {
+    *out++ = digits[--n];
+    if (n == decimals && decimals) *out++ = '.';
+  }
+  *out = '\0';
+}
+
+constexpr int32_t vpinPow10(uint8_t exponent) {
+  return exponent == 0 ? 1 : 10 * vpinPow10(exponent - 1);
+}
+
+// Fixed<D>: decimal fixed-point value stored as an int32 count of 10^-D
+// units. Fixed<2>(2315) is 23.15.
+template<uint8_t Decimals>
+class Fixed {
+public:
+  static_assert(Decimals <= 9, "Fixed supports up to 9 decimals");
+
+  constexpr explicit Fixed(int32_t raw = 0) : _raw(raw) {}
+  static Fixed fromFloat(float value) {
+    return Fixed((int32_t)(value * vpinPow10(Decimals) + (value < 0 ? -0.5f : 0.5f)));
+  }
+
+  int32_t raw() const { return _raw; }
+  float toFloat() const { return (float)_raw / vpinPow10(Decimals); }
+
+  bool operator==(const Fixed& other) const { return _raw == other._raw; }
+  bool operator!=(const Fixed& other) const { return _raw != other._raw; }
+
 private:
+  int32_t _raw;
+};
+
+// How BasicVPin compares and formats each value type. The default is for
+// signed integers up to 32 bits. A negative threshold counts by its size.
+template<typename T>
+struct VPinTraits {
+  static bool isZero(T value) { return value == 0; }
+  static bool moved(T value, T last, T threshold) {
+    int32_t a = (int32_t)value, b = (int32_t)last, t = (int32_t)threshold;
+    uint32_t distance = a > b ? (uint32_t)a - (uint32_t)b : (uint32_t)b - (uint32_t)a;
+    uint32_t limit = t < 0 ? 0u - (uint32_t)t : (uint32_t)t;
+    return distance >= limit;
+  }
+  static float toFloat(T value) { return (float)value; }
+  static String format(T value) {
+    char text[13];
+    vpinFormatFixed(text, (int32_t)value, 0);
+    return String(text);
+  }
+};
+
+template<>
+struct VPinTraits<float> {
+  static bool isZero(float value) { return value == 0; }
+  static bool moved(float value, float last, float threshold) { return abs(value - last) >= abs(threshold); }
+  static float toFloat(float value) { return value; }
+  static String format(float value) { return String(value); }
+};
+
+template<uint8_t Decimals>
+struct VPinTraits<Fixed<Decimals> > {
+  static bool isZero(Fixed<Decimals> value) { return value.raw() == 0; }
+  static bool moved(Fixed<Decimals> value, Fixed<Decimals> last, Fixed<Decimals> threshold) {
+    return VPinTraits<int32_t>::moved(value.raw(), last.raw(), threshold.raw());
+  }
+  static float toFloat(Fixed<Decimals> value) { return value.toFloat(); }
+  static String format(Fixed<Decimals> value) {
+    char text[13];
+    vpinFormatFixed(text, value.raw(), Decimals);
+    return String(text);
+  }
+};
+
+// VPinBase: the GPIO (receive) side of a virtual pin and the push timing
+// that does not depend on the value type. FirmnginKit binds pins through it.
+class VPinBase {
+protected:
   int _vpin;
   int _gpio;
   PinMode _mode;
-  
+
   // Push state variables
-  float _lastValue = 0;
   unsigned long _lastPush = 0;
   bool _onChangeEnabled = false;
   unsigned long _intervalMs = 0;
-  float _threshold = 0;
   bool _firstPush = true;
 
 public:
   // Constructor for push only (no GPIO)
-  VPin(int vpin) : _vpin(vpin), _gpio(-1), _mode(NONE) {}
+  VPinBase(int vpin) : _vpin(vpin), _gpio(-1), _mode(NONE) {}
   
   // Constructor for receive (with GPIO)
-  VPin(int vpin, int gpio, PinMode mode = DIGITAL) 
+  VPinBase(int vpin, int gpio, PinMode mode = DIGITAL) 
     : _vpin(vpin), _gpio(gpio), _mode(mode) {
     if (_gpio >= 0) {
       pinMode(_gpio, OUTPUT);
@@ -304,18 +1273,28 @@ public:
   }
   
   // === RECEIVE: Handle incoming payload from server ===
-  void handle(String payload) {
+  void handle(const String& payload) {
+    handle(payload.c_str(), payload.length());
+  }
+
+  void handle(const char* value, size_t length) {
     if (_gpio < 0) return;
-    payload.toUpperCase();
     if (_mode == PWM) {
-      int value = payload.toInt();
-      value = constrain(value, 0, 255);
-      analogWrite(_gpio, value);
+      long level = vpinParseInt(value, length);
+      analogWrite(_gpio, constrain(level, 0L, 255L));
     } else {
-      bool state = (payload == "ON" || payload == "1" || payload == "HIGH");
+      bool state = vpinStateOn(value, length);
       digitalWrite(_gpio, (_mode == ACTIVE_LOW) ? !state : state);
     }
   }
+
+  // Output level for a digital command, false for PWM or no GPIO
+  bool levelFor(const char* value, size_t length, bool& level) const {
+    if (_gpio < 0 || _mode == PWM) return false;
+    bool state = vpinStateOn(value, length);
+    level = (_mode == ACTIVE_LOW) ? !state : state;
+    return true;
+  }
   
   // === RECEIVE: Manual GPIO control ===
   void set(bool state) {
@@ -330,39 +1309,71 @@ public:
   
   void on() { set(true); }
   void off() { set(false); }
+
+  void push(String value) {
+    if (_globalFirmnginKitInstance) {
+      _globalFirmnginKitInstance->pushState(_vpin, value);
+    }
+  }
+  
+  // === Getters ===
+  int getVpin() { return _vpin; }
+  int getGpio() { return _gpio; }
+  PinMode getMode() { return _mode; }
+  bool hasGpio() { return _gpio >= 0; }
+};
+
+// BasicVPin<T>: Unified Virtual Pin for both receive and push
+// - Receive: control GPIO from server commands
+// - Push: send sensor data with smart conditions
+// T is the sample type: VPin (float), IntVPin (int32_t) or FixedVPin<D>.
+// Integer and fixed-point pins compare and format without float math.
+template<typename T>
+class BasicVPin : public VPinBase {
+private:
+  T _lastValue = T();
+  T _threshold = T();
+
+public:
+  BasicVPin(int vpin) : VPinBase(vpin) {}
+  BasicVPin(int vpin, int gpio, PinMode mode = DIGITAL) : VPinBase(vpin, gpio, mode) {}
   
   // === PUSH: Fluent API for conditions ===
-  VPin& onChange() {
+  BasicVPin& onChange() {
     _onChangeEnabled = true;
     return *this;
   }
   
-  VPin& interval(unsigned long ms) {
+  BasicVPin& interval(unsigned long ms) {
     _intervalMs = ms;
     return *this;
   }
   
-  VPin& threshold(float delta) {
+  BasicVPin& threshold(T delta) {
     _threshold = delta;
     return *this;
   }
   
   // === PUSH: Send value with conditions check ===
-  bool push(float value) {
+  bool push(T value) {
+    if (_globalFirmnginKitInstance && _globalFirmnginKitInstance->hasRules()) {
+      _globalFirmnginKitInstance->evaluateRules(_vpin, VPinTraits<T>::toFloat(value));
+    }
     unsigned long now = millis();
     bool shouldPush = false;
+    bool noThreshold = VPinTraits<T>::isZero(_threshold);
     
     if (_firstPush) {
       _firstPush = false;
       shouldPush = true;
     }
-    else if (!_onChangeEnabled && _intervalMs == 0 && _threshold == 0) {
+    else if (!_onChangeEnabled && _intervalMs == 0 && noThreshold) {
       shouldPush = true;
     }
     else {
       bool changeOk = !_onChangeEnabled || (value != _lastValue);
       bool intervalOk = _intervalMs == 0 || (now - _lastPush >= _intervalMs);
-      bool thresholdOk = _threshold == 0 || (abs(value - _lastValue) >= _threshold);
+      bool thresholdOk = noThreshold || VPinTraits<T>::moved(value, _lastValue, _threshold);
       shouldPush = changeOk && intervalOk && thresholdOk;
     }
     
@@ -370,34 +1381,33 @@ public:
       _lastValue = value;
       _lastPush = now;
       if (_globalFirmnginKitInstance) {
-        _globalFirmnginKitInstance->pushState(_vpin, String(value));
+        _globalFirmnginKitInstance->pushState(_vpin, VPinTraits<T>::format(value));
       }
       return true;
     }
     return false;
   }
+
+  using VPinBase::push;
   
-  void push(String value) {
-    if (_globalFirmnginKitInstance) {
-      _globalFirmnginKitInstance->pushState(_vpin, value);
+  void forcePush(T value) {
+    if (_globalFirmnginKitInstance && _globalFirmnginKitInstance->hasRules()) {
+      _globalFirmnginKitInstance->evaluateRules(_vpin, VPinTraits<T>::toFloat(value));
     }
-  }
-  
-  void forcePush(float value) {
     _lastValue = value;
     _lastPush = millis();
     if (_globalFirmnginKitInstance) {
-      _globalFirmnginKitInstance->pushState(_vpin, String(value));
+      _globalFirmnginKitInstance->pushState(_vpin, VPinTraits<T>::format(value));
     }
   }
   
-  // === Getters ===
-  int getVpin() { return _vpin; }
-  int getGpio() { return _gpio; }
-  float getLastValue() { return _lastValue; }
-  bool hasGpio() { return _gpio >= 0; }
+  T getLastValue() { return _lastValue; }
 };
 
+typedef BasicVPin<float> VPin;
+typedef BasicVPin<int32_t> IntVPin;
+template<uint8_t Decimals> using FixedVPin = BasicVPin<Fixed<Decimals> >;
+
 // Alias for backward compatibility
 typedef VPin PinMap;
 typedef VPin StatePin;
@@ -405,7 +1415,7 @@ typedef VPin StatePin;
 // Macro for global Virtual Pin registration
 #define ON_VPIN_1(pm) \
   static struct __VPinReg_##pm { \
-    __VPinReg_##pm() { fngin.onVirtualPin(pm.getVpin(), [](String p) { pm.handle(p); }); } \
+    __VPinReg_##pm() { fngin.bindVPin(pm); } \
   } __vpinReg_##pm
 
 #define ON_VPIN_2(pin, handler) \
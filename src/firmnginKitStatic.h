@@ -0,0 +1,378 @@
+#ifndef FIRMNGINKIT_STATIC_H
+#define FIRMNGINKIT_STATIC_H
+
+#include "firmnginKit.h"
+
+// FirmnginKitStatic: compile-time configured variant of FirmnginKit
+//
+// Device ID, topics and the feature set come from a Config struct, so topic
+// strings are string literals concatenated by the compiler (flash on ESP32,
+// .rodata on ESP8266) and disabled features are never instantiated.
+// Publishing formats into one member buffer, no String or JSON document is used.
+//
+//   struct FleetConfig : FirmnginStaticConfig {
+//     FNGIN_DEVICE_TOPICS(DEVICE_ID);
+//     static constexpr bool monetize = false;   // drop payment callbacks
+//   };
+//   FirmnginKitStatic<FleetConfig> fngin(CLIENT_CERT, PRIVATE_KEY, SERVER_FINGERPRINT_BYTES);
+//
+// VPin and BatchState bind to the runtime FirmnginKit, use pushState() and
+// publishBatchState() of this class instead.
+//
+// One instance per Config: the MQTT callback is a plain function pointer,
+// routed through one static instance pointer per Config type. A second
+// instance with the same Config takes over the callbacks, and begin() on
+// the first one then fails. Use a distinct Config type per instance.
+
+// Builds every topic for a device ID literal, e.g. "/d/" DEVICE_ID "/ps".
+// Functions rather than static members so no out-of-class definition is needed.
+#define FNGIN_DEVICE_TOPICS(id) \
+  static constexpr const char* deviceId() { return id; } \
+  static constexpr const char* pushStateTopic() { return "/d/" id "/ps"; } \
+  static constexpr const char* pushBatchStateTopic() { return "/d/" id "/psb"; } \
+  static constexpr const char* lwtTopic() { return "/d/" id "/lwt"; } \
+  static constexpr const char* downstreamTopic() { return "/d/" id "/rs/+"; } \
+  static constexpr const char* virtualPinPrefix() { return "/d/" id "/rs/"; } \
+  static constexpr const char* monetizePrefix() { return "/c/" id "/"; } \
+  static const char* monetizeTopic(uint8_t state) { \
+    static const char* const topics[] = { \
+      "/c/" id "/" T_PAYMENT_SUCCESS, "/c/" id "/" T_DEVICE_STATUS, "/c/" id "/" T_PAYMENT_PENDING, \
+      "/c/" id "/" T_PM_ON_PAYMENT, "/c/" id "/" T_PM_ON_EXPIRED, "/c/" id "/" T_PM_ON_SUCCESS }; \
+    return topics[state]; \
+  } \
+  static constexpr const char* endSessionTopic() { return "fngin/" id; }
+
+// Defaults, override any of them in the derived Config
+struct FirmnginStaticConfig {
+  static constexpr bool monetize = true;
+  static constexpr bool batch = true;
+  static constexpr bool virtualPins = true;
+  static constexpr uint8_t maxVirtualPins = 16;
+  static constexpr uint16_t bufferSize = 1024;
+  static constexpr uint16_t tlsRxBufferSize = 512;
+  static constexpr uint16_t tlsTxBufferSize = 512;
+  static constexpr uint16_t keepAlive = DEFAULT_MQTT_KEEPALIVE;
+  static constexpr int mqttPort = DEFAULT_MQTT_PORT;
+  static constexpr long gmtOffsetSec = 7 * 3600;
+  static constexpr const char* mqttServer = DEFAULT_MQTT_SERVER;
+  static constexpr const char* ntpServer = "pool.ntp.org";
+};
+
+// payload is not null-terminated, use length
+typedef void (*StaticPayloadCallback)(const char* payload, unsigned int length);
+
+template <class Config>
+class FirmnginKitStatic {
+public:
+#if defined(ESP8266)
+  FirmnginKitStatic(const char* clientCert, const char* privateKey, const uint8_t* fingerprint)
+    : _mqttClient(_wifiClient), _clientCert(clientCert), _privateKey(privateKey), _fingerprint(fingerprint) {
+    _instance = this;
+  }
+#elif defined(ESP32)
+  FirmnginKitStatic(const char* caCert, const char* clientCert, const char* privateKey)
+    : _mqttClient(_wifiClient), _caCert(caCert), _clientCert(clientCert), _privateKey(privateKey) {
+    _instance = this;
+  }
+  FirmnginKitStatic(const uint8_t* fingerprint, const char* clientCert, const char* privateKey)
+    : _mqttClient(_wifiClient), _clientCert(clientCert), _privateKey(privateKey), _fingerprint(fingerprint) {
+    _instance = this;
+  }
+#endif
+
+  ~FirmnginKitStatic() {
+    if (_instance == this) _instance = nullptr;
+    releaseCredentials();
+  }
+
+  FirmnginKitStatic(const FirmnginKitStatic&) = delete;
+  FirmnginKitStatic& operator=(const FirmnginKitStatic&) = delete;
+
+  void begin() {
+    if (!PLATFORM_SUPPORTED) return;
+    if (_instance != this) {
+      Serial.println(F("ERROR: Another FirmnginKitStatic instance uses this Config"));
+      return;
+    }
+
+    if (WiFi.status() != WL_CONNECTED) {
+      Serial.println(F("ERROR: WiFi not connected"));
+      delay(2000);
+      ESP.restart();
+      return;
+    }
+
+    configTime(Config::gmtOffsetSec, 0, Config::ntpServer);
+    for (int i = 0; i < 20 && time(nullptr) < 1577836800; i++) {
+      delay(100);
+    }
+
+#if defined(ESP8266)
+    if (!_clientCert || !_privateKey || !_fingerprint) {
+      Serial.println(F("ERROR: Client certificate, private key and fingerprint are required"));
+      return;
+    }
+    // begin() again: the client must not keep using the old credentials
+    _mqttClient.disconnect();
+    releaseCredentials();
+    _clientCertList = new BearSSL::X509List(_clientCert);
+    _clientPrivKey = new BearSSL::PrivateKey(_privateKey);
+    _wifiClient.setClientRSACert(_clientCertList, _clientPrivKey);
+    _wifiClient.setBufferSizes(Config::tlsRxBufferSize, Config::tlsTxBufferSize);
+    _wifiClient.setFingerprint(_fingerprint);
+#elif defined(ESP32)
+    if (!_clientCert || !_privateKey) {
+      Serial.println(F("ERROR: Client certificate and private key are required"));
+      return;
+    }
+    if (_caCert) {
+      _wifiClient.setCACert(_caCert);
+    } else if (_fingerprint) {
+      _wifiClient.setInsecure();
+    } else {
+      Serial.println(F("ERROR: Either CA certificate or fingerprint is required"));
+      return;
+    }
+    _wifiClient.setCertificate(_clientCert);
+    _wifiClient.setPrivateKey(_privateKey);
+    _wifiClient.setTimeout(30);
+#endif
+
+    _mqttClient.setServer(Config::mqttServer, Config::mqttPort);
+    _mqttClient.setCallback(callbackTrampoline);
+    _mqttClient.setBufferSize(Config::bufferSize);
+    _mqttClient.setKeepAlive(Config::keepAlive);
+    _mqttClient.setSocketTimeout(20);
+  }
+
+  void loop() {
+    if (!PLATFORM_SUPPORTED || WiFi.status() != WL_CONNECTED) return;
+
+    if (_mqttClient.connected()) {
+      _mqttClient.loop();
+      return;
+    }
+
+    unsigned long now = millis();
+    if (now - _lastReconnectAttempt > _backoffDelay) {
+      _lastReconnectAttempt = now;
+      _backoffDelay = min(_backoffDelay * 2, 60000UL);
+      if (connectServer()) {
+        _backoffDelay = 5000;
+      }
+    }
+  }
+
+  bool connected() { return _mqttClient.connected(); }
+
+  // === Push state: {"key":"<key>","value":"<value>"} ===
+  bool pushState(int key, const char* value) {
+    char keyStr[12];
+    formatInt(keyStr, key);
+    return pushState(keyStr, value);
+  }
+
+  bool pushState(int key, long value) {
+    char keyStr[12];
+    char valueStr[12];
+    formatInt(keyStr, key);
+    formatInt(valueStr, value);
+    return pushState(keyStr, valueStr);
+  }
+
+  bool pushState(int key, int value) { return pushState(key, (long)value); }
+
+  bool pushState(int key, float value, uint8_t decimals = 2) {
+    char keyStr[12];
+    char valueStr[24];
+    formatInt(keyStr, key);
+    dtostrf(value, 1, decimals, valueStr);
+    return pushState(keyStr, valueStr);
+  }
+
+  bool pushState(const char* key, const char* value) {
+    if (!_mqttClient.connected()) return false;
+
+    size_t len = 0;
+    len = append(_payload, len, "{\"key\":\"", false);
+    len = append(_payload, len, key, true);
+    len = append(_payload, len, "\",\"value\":\"", false);
+    len = append(_payload, len, value, true);
+    len = append(_payload, len, "\"}", false);
+    if (len >= sizeof(_payload)) return false;
+
+    return _mqttClient.publish(Config::pushStateTopic(), (const uint8_t*)_payload, len);
+  }
+
+  // === Batch: caller provides the serialized JSON array ===
+  bool publishBatchState(const char* json, size_t length) {
+    static_assert(Config::batch, "Batch state is disabled in this Config");
+    if (!_mqttClient.connected()) return false;
+    return _mqttClient.publish(Config::pushBatchStateTopic(), (const uint8_t*)json, length);
+  }
+
+  bool publishBatchState(const char* json) { return publishBatchState(json, strlen(json)); }
+
+  // === Callbacks (plain function pointers, no std::function) ===
+  void onStateMonetize(DeviceStateType state, StaticPayloadCallback callback) {
+    static_assert(Config::monetize, "Monetize callbacks are disabled in this Config");
+    _stateCallbacks[state] = callback;
+  }
+
+  void onVirtualPin(int pinId, StaticPayloadCallback callback) {
+    static_assert(Config::virtualPins, "Virtual pins are disabled in this Config");
+    for (uint8_t i = 0; i < Config::maxVirtualPins; i++) {
+      if (_vpins[i].callback == nullptr || _vpins[i].pin == pinId) {
+        _vpins[i].pin = pinId;
+        _vpins[i].callback = callback;
+        return;
+      }
+    }
+  }
+
+  void endSession() {
+    if (!_mqttClient.connected()) return;
+    static const char payload[] = "{\"state\":\"end_session\"}";
+    _mqttClient.publish(Config::endSessionTopic(), (const uint8_t*)payload, sizeof(payload) - 1);
+  }
+
+private:
+  struct VirtualPinSlot {
+    int pin = 0;
+    StaticPayloadCallback callback = nullptr;
+  };
+
+#if defined(ESP8266) || defined(ESP32)
+  WiFiClientSecure _wifiClient;
+#else
+  WiFiClient _wifiClient;
+#endif
+  PubSubClient _mqttClient;
+  unsigned long _lastReconnectAttempt = 0;
+  unsigned long _backoffDelay = 5000;
+  uint8_t _failedConnects = 0;
+  // Outgoing payloads; a member so the ESP8266 loop stack (4 KB) is not used
+  char _payload[Config::bufferSize];
+
+  const char* _caCert = nullptr;
+  const char* _clientCert = nullptr;
+  const char* _privateKey = nullptr;
+  const uint8_t* _fingerprint = nullptr;
+#if defined(ESP8266)
+  BearSSL::X509List* _clientCertList = nullptr;
+  BearSSL::PrivateKey* _clientPrivKey = nullptr;
+#endif
+
+  // Disabled features keep a single unused slot
+  StaticPayloadCallback _stateCallbacks[Config::monetize ? 6 : 1] = {};
+  VirtualPinSlot _vpins[Config::virtualPins ? Config::maxVirtualPins : 1];
+
+  static FirmnginKitStatic* _instance;
+
+  static void callbackTrampoline(char* topic, uint8_t* payload, unsigned int length) {
+    if (_instance) _instance->mqttCallback(topic, payload, length);
+  }
+
+  static void formatInt(char* out, long value) {
+    char tmp[12];
+    int n = 0;
+    unsigned long v = value < 0 ? -(unsigned long)value : value;
+    do {
+      tmp[n++] = '0' + (v % 10);
+      v /= 10;
+    } while (v);
+    if (value < 0) *out++ = '-';
+    while (n) *out++ = tmp[--n];
+    *out = '\0';
+  }
+
+  // Appends src, escaping quotes and backslashes when needed; stops at the buffer end
+  static size_t append(char* out, size_t len, const char* src, bool escape) {
+    for (; *src && len < Config::bufferSize; src++) {
+      if (escape && (*src == '"' || *src == '\\')) {
+        out[len++] = '\\';
+        if (len >= Config::bufferSize) break;
+      }
+      out[len++] = *src;
+    }
+    return len;
+  }
+
+  void releaseCredentials() {
+#if defined(ESP8266)
+    delete _clientCertList;
+    delete _clientPrivKey;
+    _clientCertList = nullptr;
+    _clientPrivKey = nullptr;
+#endif
+  }
+
+  static bool startsWith(const char* str, const char* prefix, size_t& prefixLen) {
+    prefixLen = strlen(prefix);
+    return strncmp(str, prefix, prefixLen) == 0;
+  }
+
+  // One attempt per call, loop() spaces them out with its backoff
+  bool connectServer() {
+    _mqttClient.disconnect();
+    if (_mqttClient.connect(Config::deviceId(), Config::lwtTopic(), 1, true, "0")) {
+      _failedConnects = 0;
+
+      if (Config::monetize) {
+        for (uint8_t i = 0; i < 6; i++) {
+          _mqttClient.subscribe(Config::monetizeTopic(i), 1);
+        }
+      }
+      if (Config::virtualPins) {
+        _mqttClient.subscribe(Config::downstreamTopic(), 1);
+      }
+
+      _mqttClient.publish(Config::lwtTopic(), "", true);
+      delay(10);
+      _mqttClient.publish(Config::lwtTopic(), "1", true);
+      Serial.println(F("Ready..."));
+      return true;
+    }
+
+    Serial.print(F("Connection failed, rc="));
+    Serial.println(_mqttClient.state());
+    if (++_failedConnects >= 3) {
+      Serial.println(F("Connection failed, restarting..."));
+      delay(1000);
+      ESP.restart();
+    }
+    return false;
+  }
+
+  void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+    // Payload points into the MQTT buffer and is not null-terminated
+    const char* text = (const char*)payload;
+    size_t prefixLen;
+
+    if (Config::virtualPins && startsWith(topic, Config::virtualPinPrefix(), prefixLen)) {
+      int pinId = atoi(topic + prefixLen);
+      for (uint8_t i = 0; i < Config::maxVirtualPins && _vpins[i].callback; i++) {
+        if (_vpins[i].pin == pinId) {
+          _vpins[i].callback(text, length);
+          return;
+        }
+      }
+      return;
+    }
+
+    if (Config::monetize && startsWith(topic, Config::monetizePrefix(), prefixLen)) {
+      const char* stateType = topic + prefixLen;
+      for (uint8_t i = 0; i < 6; i++) {
+        if (strcmp(stateType, STATE_NAMES[i]) == 0) {
+          if (_stateCallbacks[i]) _stateCallbacks[i](text, length);
+          return;
+        }
+      }
+    }
+  }
+};
+
+template <class Config>
+FirmnginKitStatic<Config>* FirmnginKitStatic<Config>::_instance = nullptr;
+
+#endif // FIRMNGINKIT_STATIC_H
@@ -17,7 +17,7 @@ src_dir = project_dir / "src"
 examples_dir = project_dir / "examples"
 lib_dir = project_dir / "lib" / "firmnginKit"
 
-files_to_copy = ["firmnginKit.h", "firmnginKit.cpp"]
+files_to_copy = ["firmnginKit.h", "firmnginKit.cpp", "firmnginKitStatic.h"]
 
 def sync_to_directory(dst_dir, label=""):
     """Sync files to a specific directory"""